@@ -0,0 +1,169 @@
+#include "docgen.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+struct Gen {
+  DocShape shape;
+  std::string out;
+  u64 state;
+  u32 n_elements = 0;
+
+  u32 next(u32 n) {
+    // xorshift64*, the same sequence for the same seed everywhere
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return u32((state * 0x2545f4914f6cdd1dull) >> 32) % n;
+  }
+
+  void indent(u32 level) { out.append(2 * level + 2, ' '); }
+  void num(u32 n) { out += std::to_string(n); }
+
+  void vars() {
+    for (u32 i = 0; i < shape.variables; i++) {
+      out += "var_";
+      num(i);
+      if (i % 2 == 0) {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), " = #%06x;\n", next(1 << 24));
+        out += buf;
+      } else {
+        out += " = ";
+        num(5 + next(40));
+        out += "%;\n";
+      }
+    }
+  }
+
+  // the name of a color variable, if there are any
+  bool color_var(std::string &name) {
+    u32 n_colors = (shape.variables + 1) / 2;
+    if (!n_colors)
+      return false;
+    name = "$var_" + std::to_string(2 * next(n_colors));
+    return true;
+  }
+
+  void styles() {
+    std::string color;
+    for (u32 i = 0; i < shape.styles; i++) {
+      out += "%style style_";
+      num(i);
+      out += " = {\n";
+      if (color_var(color))
+        out += "  background_color = " + color + ";\n";
+      out += "  margin_t = ";
+      num(next(4));
+      out += "vw;\n  padding = ";
+      num(1 + next(4));
+      out += "%;\n";
+      if (next(2)) {
+        out += "  corner_radius = ";
+        num(4 + next(20));
+        out += ";\n";
+      }
+      out += "};\n\n";
+    }
+  }
+
+  void leaf(u32 level) {
+    indent(level);
+    out += "box";
+    if (next(4) == 0) {
+      out += " b";
+      num(n_elements);
+    }
+    std::string color;
+    if (shape.styles && next(2)) {
+      out += " (style = $style_";
+      num(next(shape.styles));
+      out += ")";
+    } else if (color_var(color)) {
+      out += " (background_color = " + color;
+      if (next(100) < shape.rounded_pc) {
+        out += ", corner_radius = ";
+        num(2 + next(16));
+      }
+      out += ")";
+    }
+  }
+
+  char const *container_kind(bool &split) {
+    u32 weights[] = {shape.row, shape.column, shape.hsplit, shape.vsplit,
+                     shape.layers};
+    char const *names[] = {"row", "column", "hsplit", "vsplit", "layers"};
+    u32 total = 0;
+    for (auto w : weights)
+      total += w;
+    u32 pick = next(std::max(total, 1u));
+    u32 k = 0;
+    while (k < 4 && pick >= weights[k])
+      pick -= weights[k++];
+    split = k == 2 || k == 3;
+    return names[k];
+  }
+
+  // an element and its subtree, with at most `budget` elements
+  void element(u32 level, u32 budget) {
+    n_elements++;
+    if (budget <= 1 || level + 1 >= shape.depth) {
+      leaf(level);
+      return;
+    }
+    bool split;
+    char const *kind = container_kind(split);
+    u32 levels = shape.depth - level - 1;
+    if (split && (budget < 3 || (levels == 1 && budget != 3))) {
+      // the two children of a split could not spend the budget
+      kind = next(2) ? "row" : "column";
+      split = false;
+    }
+    // enough children to spend the budget in the levels left
+    u32 fanout = u32(std::ceil(std::pow(f64(budget - 1), 1.0 / levels)));
+    u32 n_children = split ? 2 : std::clamp(fanout, 1u, budget - 1);
+    indent(level);
+    out += kind;
+    if (split) {
+      out += " (loc = ";
+      num(20 + next(60));
+      out += "%)";
+    } else if (next(2)) {
+      out += " (gap = 1vw)";
+    }
+    out += " {\n";
+    // the budget left is shared between the children
+    u32 left = budget - 1;
+    for (u32 i = 0; i < n_children; i++) {
+      u32 share = left / (n_children - i);
+      element(level + 1, share);
+      left -= share;
+      out += i + 1 < n_children ? ",\n" : "\n";
+    }
+    indent(level);
+    out += "}";
+  }
+};
+
+} // namespace
+
+std::string generate_document(DocShape const &shape) {
+  Gen g;
+  g.shape = shape;
+  g.state = shape.seed * 0x9e3779b97f4a7c15ull + 1;
+  g.out += "%% generated document\n\n";
+  g.vars();
+  g.out += "\n";
+  g.styles();
+  if (shape.pages)
+    g.out += "%format = A4;\n\n";
+  u32 n_layouts = std::max(shape.pages, 1u);
+  for (u32 i = 0; i < n_layouts; i++) {
+    g.out += "%layout =\n";
+    g.element(0, std::max(shape.elements / n_layouts, 1u));
+    g.out += ";\n";
+  }
+  return g.out;
+}
@@ -0,0 +1,26 @@
+#ifndef DOCGEN_HPP
+#define DOCGEN_HPP
+
+#include "../src/defines.hpp"
+#include <string>
+
+// Shape of a generated document. The result looks like `spec`: color and
+// size variables, named styles reading them, then one layout, or one per
+// page.
+struct DocShape {
+  u32 elements = 1000; // layout elements, containers included
+  u32 depth = 6;       // of the layout tree
+  u32 styles = 16;
+  u32 variables = 32;
+  // relative frequency of each container kind
+  u32 row = 3, column = 3, hsplit = 1, vsplit = 1, layers = 1;
+  // percentage of leaf boxes with a corner radius
+  u32 rounded_pc = 30;
+  // with a `%format`, the elements shared by as many layouts, 0 for none
+  u32 pages = 0;
+  u64 seed = 1;
+};
+
+std::string generate_document(DocShape const &shape);
+
+#endif // !DOCGEN_HPP
@@ -0,0 +1,146 @@
+#include "../src/file/filedata.hpp"
+#include "../src/file/lexer.hpp"
+#include "../src/file/parser.hpp"
+#include "../src/file/scan.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Lexer microbenchmark: tokens/second of the lazy (lookahead queue) lexer
+// against the flat pre-tokenized stream, on a synthetic multi-MB document.
+
+static std::string make_document(u32 n_boxes, bool sparse = false) {
+  std::string out;
+  out += "%% synthetic benchmark document\n";
+  for (u32 i = 0; i < 64; i++) {
+    out += "color_" + std::to_string(i) + " = #" + std::to_string(100000 + i) +
+           ";\n";
+  }
+  for (u32 i = 0; i < 64; i++) {
+    out += "%style style_" + std::to_string(i) + " = {\n";
+    out += "  background_color = $color_" + std::to_string(i) + ";\n";
+    out += "  margin_t = 3vw;\n  padding_x = 2%;\n  corner_radius = 20;\n};\n";
+  }
+  out += "%layout = column {\n";
+  for (u32 i = 0; i < n_boxes; i++) {
+    out += "  %% box " + std::to_string(i) + "\n";
+    if (sparse) {
+      // long comments and deep indentation, like generated sources
+      out += "  %% ---------------------------------------------------------"
+             "------------------- generated entry\n";
+      out += "                                ";
+    }
+    out += "  row (gap = 1vw, h = 3vh) {\n";
+    out += "    box b" + std::to_string(i) + " (style = $style_" +
+           std::to_string(i % 64) + ", w = 20%),\n";
+    out += "    box (background_color = #ff00ff80, corner_radius = 4)\n";
+    out += "  },\n";
+  }
+  out += "  box\n};\n";
+  return out;
+}
+
+template <typename F> static f64 best_of(u32 runs, F &&f) {
+  f64 best = 1e30;
+  for (u32 i = 0; i < runs; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<f64>(t1 - t0).count());
+  }
+  return best;
+}
+
+static void open_doc(Lexer &l, std::string const &doc) {
+  SourceFile src;
+  src.assign(std::string(doc));
+  l.open_source("<bench>", std::move(src));
+}
+
+int main(int argc, char **argv) {
+  u32 n_boxes = argc > 1 ? std::atoi(argv[1]) : 40000;
+  auto doc = make_document(n_boxes);
+  constexpr u32 RUNS = 9;
+
+  u64 n_tokens = 0;
+  auto lazy = best_of(RUNS, [&] {
+    Lexer l;
+    open_doc(l, doc);
+    n_tokens = 0;
+    while (l.lex().kind != Tok::END)
+      n_tokens++;
+  });
+
+  auto flat = best_of(RUNS, [&] {
+    Lexer l;
+    open_doc(l, doc);
+    l.pretokenize();
+    while (l.lex().kind != Tok::END)
+      ;
+  });
+
+  // parser-like access with deep lookahead before every token
+  auto peek_lazy = best_of(RUNS, [&] {
+    Lexer l;
+    open_doc(l, doc);
+    while (l.look_ahead(8).kind != Tok::END || l.look_ahead(1).kind != Tok::END)
+      l.lex();
+  });
+
+  auto peek_flat = best_of(RUNS, [&] {
+    Lexer l;
+    open_doc(l, doc);
+    l.pretokenize();
+    while (l.look_ahead(8).kind != Tok::END || l.look_ahead(1).kind != Tok::END)
+      l.lex();
+  });
+
+  auto parse_lazy = best_of(RUNS, [&] {
+    SourceFile src;
+    src.assign(std::string(doc));
+    Parser p;
+    p.flat_tokens = false;
+    p.read_cv_source("<bench>", std::move(src));
+  });
+
+  auto parse_flat = best_of(RUNS, [&] {
+    SourceFile src;
+    src.assign(std::string(doc));
+    Parser p;
+    p.flat_tokens = true;
+    p.read_cv_source("<bench>", std::move(src));
+  });
+
+  std::printf("input: %.2f MB, %llu tokens\n", doc.size() / 1e6,
+              (unsigned long long)n_tokens);
+  std::printf("scanner    : %s\n", scanner.name);
+  std::printf("lex lazy   : %8.2f Mtok/s\n", n_tokens / lazy / 1e6);
+  std::printf("lex flat   : %8.2f Mtok/s\n", n_tokens / flat / 1e6);
+  std::printf("peek lazy  : %8.2f Mtok/s\n", n_tokens / peek_lazy / 1e6);
+  std::printf("peek flat  : %8.2f Mtok/s\n", n_tokens / peek_flat / 1e6);
+  std::printf("parse lazy : %8.2f Mtok/s\n", n_tokens / parse_lazy / 1e6);
+  std::printf("parse flat : %8.2f Mtok/s\n", n_tokens / parse_flat / 1e6);
+
+  // the same lazy lexing with every byte scanner the cpu supports, on the
+  // dense document and on one padded with comments and indentation
+  auto sparse_doc = make_document(n_boxes, true);
+  Scanner selected = scanner;
+  for (auto name : {"scalar", "sse2", "avx2"}) {
+    if (!use_scanner(name))
+      continue;
+    for (auto const *d : {&doc, &sparse_doc}) {
+      auto t = best_of(RUNS, [&] {
+        Lexer l;
+        open_doc(l, *d);
+        while (l.lex().kind != Tok::END)
+          ;
+      });
+      std::printf("lex %-6s : %8.2f Mtok/s, %7.1f MB/s (%s)\n", name,
+                  n_tokens / t / 1e6, d->size() / t / 1e6,
+                  d == &doc ? "dense" : "sparse");
+    }
+  }
+  scanner = selected;
+  return 0;
+}
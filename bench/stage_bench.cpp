@@ -0,0 +1,283 @@
+#include "../src/file/parser.hpp"
+#include "../src/file/scan.hpp"
+#include "../src/pages.hpp"
+#include "../src/render/renderbatch.hpp"
+#include "../src/render/renderbox.hpp"
+#include "docgen.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Per-stage benchmark on generated documents: times lexing, parsing,
+// RenderTree construction, RenderTree::layout after a resize, a whole resize
+// (relayout, the values in vw and vh resolved again), restyling the boxes of
+// one style, RenderTree::emit, RenderBatch::rects (with float and compact
+// vertices) and RenderBatch::patch separately, and prints the results as
+// JSON on stdout, with the size of the geometry.
+//
+//   cvtxt_bench [-n 100,10000] [-d depth] [-s styles] [-v variables]
+//               [--mix row,column,hsplit,vsplit,layers] [--rounded pc]
+//               [--pages n] [--runs n] [--threads n] [--write file]
+//
+// --pages splits the elements in as many pages, the stages then run on the
+// first one, and "open" times showing it from the whole document. --threads
+// sets the layout threads, 0 (the default) for as many as the cpu has.
+// --write only writes the document generated for the first -n and exits.
+
+static char const USAGE[] =
+    "usage: cvtxt_bench [-n 100,10000] [-d depth] [-s styles] "
+    "[-v variables]\n"
+    "                   [--mix row,column,hsplit,vsplit,layers] "
+    "[--rounded pc]\n"
+    "                   [--pages n] [--runs n] [--threads n] "
+    "[--write file]\n";
+
+static constexpr f32 VIEW_W = 1240, VIEW_H = 1754;
+
+template <typename F> static f64 best_of(u32 runs, F &&f) {
+  f64 best = 1e30;
+  for (u32 i = 0; i < runs; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<f64>(t1 - t0).count());
+  }
+  return best;
+}
+
+static SourceFile source_of(std::string const &doc) {
+  SourceFile src;
+  src.assign(std::string(doc));
+  return src;
+}
+
+// bytes of the vertices and indices of `batch`
+static u64 geometry_bytes(RenderBatch const &batch) {
+  u64 n = 0;
+  for (auto const &ch : batch.chunks)
+    n += ch.vertices.size() + ch.indices.size() * sizeof(RenderBatch::Index);
+  return n;
+}
+
+static std::vector<u32> parse_list(char const *s) {
+  std::vector<u32> out;
+  while (*s) {
+    char *end;
+    out.push_back(std::strtoul(s, &end, 10));
+    if (*end != ',')
+      break;
+    s = end + 1;
+  }
+  return out;
+}
+
+static void run(DocShape const &shape, u32 runs, u32 threads, bool first) {
+  auto doc = generate_document(shape);
+
+  u64 n_tokens = 0;
+  auto lex = best_of(runs, [&] {
+    Lexer l;
+    l.open_source("<bench>", source_of(doc));
+    n_tokens = 0;
+    while (l.lex().kind != Tok::END)
+      n_tokens++;
+  });
+
+  CV cv;
+  bool had_error = false;
+  auto parse = best_of(runs, [&] {
+    Parser p;
+    cv = p.read_cv_source("<bench>", source_of(doc));
+    had_error = p.errors.had_error;
+  });
+  cv.width = VIEW_W;
+  cv.height = VIEW_H;
+
+  // as the pipeline does it, shared by the tree and the pages
+  std::unique_ptr<TaskPool> pool;
+  u32 n_threads = threads ? threads : std::thread::hardware_concurrency();
+  if (n_threads > 1)
+    pool = std::make_unique<TaskPool>(n_threads);
+
+  RenderTree tree;
+  StyleCache styles;
+  auto build = best_of(runs, [&] {
+    tree = RenderTree();
+    tree.pool = pool.get();
+    styles.reset(cv);
+    tree.update(cv, cv.layout[0].root, styles);
+  });
+
+  // every run is a resize, so that all the boxes are placed again
+  u32 run = 0;
+  auto layout = best_of(runs, [&] {
+    tree.layout({0, 0, VIEW_W - f32(run++ % 2), VIEW_H});
+  });
+  tree.layout({0, 0, VIEW_W, VIEW_H});
+
+  // as the pipeline does it
+  auto relayout = best_of(runs, [&] {
+    cv.width = VIEW_W - f32(run++ % 2);
+    tree.resize(cv, styles);
+    tree.layout({0, 0, cv.width, VIEW_H});
+  });
+  cv.width = VIEW_W;
+  tree.resize(cv, styles);
+  tree.layout({0, 0, VIEW_W, VIEW_H});
+
+  // what reparsing an edit of the first style leads to
+  CVChanges edit;
+  if (!cv.style.empty())
+    edit.styles.push_back(0);
+  auto restyle = best_of(runs, [&] {
+    tree.restyle(cv, edit, styles);
+    tree.layout({0, 0, VIEW_W, VIEW_H});
+  });
+
+  RenderList list;
+  auto emit = best_of(runs, [&] {
+    list.clear();
+    tree.emit(list);
+  });
+
+  RenderBatch batch;
+  auto tessellate = best_of(runs, [&] {
+    batch.clear();
+    batch.rects(list);
+  });
+  u64 vertices = 0, indices = 0;
+  for (auto const &ch : batch.chunks) {
+    vertices += ch.vertex_count();
+    indices += ch.index_count();
+  }
+
+  RenderBatch compact;
+  compact.compact = true;
+  auto tessellate_compact = best_of(runs, [&] {
+    compact.clear();
+    compact.rects(list);
+  });
+
+  // one command in a hundred recolored, back and forth
+  RenderList recolored = list;
+  for (u64 k = 0; k < recolored.size(); k += 100)
+    recolored[k].c = Color(u32(recolored[k].c) ^ 0xffffff00);
+  ListDiff diff;
+  u32 patched = 0;
+  auto patch = best_of(runs, [&] {
+    bool back = patched++ % 2;
+    batch.patch(back ? recolored : list, back ? list : recolored, diff);
+  });
+
+  // what a paged document costs before its first page is shown
+  f64 open = 0;
+  if (cv.format.is_set()) {
+    open = best_of(runs, [&] {
+      Pages pages;
+      pages.pool = pool.get();
+      pages.set_document(cv);
+      pages.page(cv, 0);
+    });
+  }
+
+  std::printf("%s\n    {\"elements\": %u, \"depth\": %u, \"styles\": %u, "
+              "\"variables\": %u, \"rounded_pc\": %u, \"pages\": %u,\n",
+              first ? "" : ",", shape.elements, shape.depth, shape.styles,
+              shape.variables, shape.rounded_pc, shape.pages);
+  std::printf("     \"bytes\": %zu, \"tokens\": %llu, \"nodes\": %zu, "
+              "\"commands\": %zu, \"vertices\": %llu, \"indices\": %llu, "
+              "\"parse_error\": %s,\n",
+              doc.size(), n_tokens, cv.nodes.size(), list.size(), vertices,
+              indices, had_error ? "true" : "false");
+  std::printf("     \"chunks\": %zu, \"geometry_bytes\": %llu, "
+              "\"compact_bytes\": %llu,\n",
+              batch.chunks.size(), geometry_bytes(batch),
+              geometry_bytes(compact));
+  std::printf("     \"seconds\": {\"lex\": %.6g, \"parse\": %.6g, "
+              "\"build\": %.6g, \"layout\": %.6g, \"relayout\": %.6g, "
+              "\"restyle\": %.6g, \"emit\": %.6g, \"tessellate\": %.6g, "
+              "\"tessellate_compact\": %.6g, \"patch\": %.6g, "
+              "\"open\": %.6g},\n",
+              lex, parse, build, layout, relayout, restyle, emit, tessellate,
+              tessellate_compact, patch, open);
+  std::printf("     \"patch\": {\"reused\": %u, \"updated\": %u, "
+              "\"added\": %u, \"removed\": %u}}",
+              diff.reused, diff.updated, diff.added, diff.removed);
+}
+
+int main(int argc, char **argv) {
+  DocShape shape;
+  std::vector<u32> counts = {100, 1000, 10000, 100000, 1000000};
+  u32 runs = 5;
+  u32 threads = 0;
+  char const *write_to = nullptr;
+
+  for (int i = 1; i < argc; i += 2) {
+    char const *opt = argv[i];
+    if (!std::strcmp(opt, "-h") || !std::strcmp(opt, "--help")) {
+      std::fputs(USAGE, stdout);
+      return 0;
+    }
+    if (i + 1 == argc) {
+      std::fprintf(stderr, "missing value for %s\n%s", opt, USAGE);
+      return 1;
+    }
+    char const *val = argv[i + 1];
+    if (!std::strcmp(opt, "-n")) {
+      counts = parse_list(val);
+    } else if (!std::strcmp(opt, "-d")) {
+      shape.depth = std::atoi(val);
+    } else if (!std::strcmp(opt, "-s")) {
+      shape.styles = std::atoi(val);
+    } else if (!std::strcmp(opt, "-v")) {
+      shape.variables = std::atoi(val);
+    } else if (!std::strcmp(opt, "--mix")) {
+      auto mix = parse_list(val);
+      mix.resize(5);
+      shape.row = mix[0];
+      shape.column = mix[1];
+      shape.hsplit = mix[2];
+      shape.vsplit = mix[3];
+      shape.layers = mix[4];
+    } else if (!std::strcmp(opt, "--rounded")) {
+      shape.rounded_pc = std::atoi(val);
+    } else if (!std::strcmp(opt, "--pages")) {
+      shape.pages = std::atoi(val);
+    } else if (!std::strcmp(opt, "--runs")) {
+      runs = std::max(1, std::atoi(val));
+    } else if (!std::strcmp(opt, "--threads")) {
+      threads = std::atoi(val);
+    } else if (!std::strcmp(opt, "--write")) {
+      write_to = val;
+    } else {
+      std::fprintf(stderr, "unknown option %s\n%s", opt, USAGE);
+      return 1;
+    }
+  }
+  if (counts.empty())
+    return 1;
+
+  if (write_to) {
+    shape.elements = counts[0];
+    auto doc = generate_document(shape);
+    FILE *f = std::fopen(write_to, "wb");
+    if (!f)
+      return 1;
+    std::fwrite(doc.data(), 1, doc.size(), f);
+    return std::fclose(f) == 0 ? 0 : 1;
+  }
+
+  std::printf("{\"scanner\": \"%s\", \"runs\": %u, \"threads\": %u, "
+              "\"results\": [",
+              scanner.name, runs, threads);
+  for (u32 i = 0; i < counts.size(); i++) {
+    shape.elements = counts[i];
+    run(shape, runs, threads, i == 0);
+  }
+  std::printf("\n]}\n");
+  return 0;
+}
@@ -0,0 +1,406 @@
+#include "cache.hpp"
+#include "hash.hpp"
+#include "source.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <new>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace {
+
+struct Section {
+  u64 offset; // from the start of the file
+  u64 count;  // of elements
+};
+
+enum SectionId {
+  SEC_NAME_OFFSETS,
+  SEC_NAME_CHARS,
+  SEC_LAYOUT,
+  SEC_NODES,
+  SEC_PROP_VALUES,
+  SEC_STYLE,
+  SEC_VARIABLES,
+  SEC_VARIABLE_INDEX,
+  SEC_FORMAT,
+  SEC_DECLS,
+  SEC_DECL_DEPS,
+  SEC_DECL_REFS,
+  SEC_COUNT,
+};
+
+// a DeclInfo, its deps and refs in their own sections
+struct DeclRecord {
+  DeclKind kind;
+  Atom name;
+  u32 begin, end;
+  u64 hash;
+  u32 index, vars_before, node_count;
+  u32 deps_begin, deps_count;
+  u32 refs_begin, refs_count;
+};
+
+struct Header {
+  char magic[4];
+  u32 version;
+  u64 key;
+  Section sections[SEC_COUNT];
+};
+
+constexpr char MAGIC[4] = {'C', 'V', 'C', '\0'};
+
+static_assert(std::is_trivially_copyable_v<Layout> &&
+              std::is_trivially_copyable_v<LayoutNode> &&
+              std::is_trivially_copyable_v<Value> &&
+              std::is_trivially_copyable_v<Style> &&
+              std::is_trivially_copyable_v<Variable> &&
+              std::is_trivially_copyable_v<PageFormat> &&
+              std::is_trivially_copyable_v<VarRef>);
+
+u64 align8(u64 n) { return (n + 7) & ~u64(7); }
+
+template <typename T>
+void add_section(std::string &buf, Header &h, SectionId id, T const *data,
+                 u64 count) {
+  buf.resize(align8(buf.size()));
+  h.sections[id] = {buf.size(), count};
+  buf.append(reinterpret_cast<char const *>(data), count * sizeof(T));
+}
+
+// A section of `count` records of T, each set by `fill(record, i)` over
+// zeros, so that padding is written as zeros and the same CV always gives
+// the same bytes
+template <typename T, typename F>
+void add_records(std::string &buf, Header &h, SectionId id, u64 count,
+                 F fill) {
+  buf.resize(align8(buf.size()));
+  h.sections[id] = {buf.size(), count};
+  for (u64 i = 0; i < count; i++) {
+    alignas(T) char bytes[sizeof(T)] = {};
+    fill(*new (bytes) T, i);
+    buf.append(bytes, sizeof(T));
+  }
+}
+
+// copies a section out of the mapping, checking it is inside of it
+template <typename T>
+bool get_section(SourceFile const &f, Header const &h, SectionId id,
+                 std::vector<T> &out) {
+  auto s = h.sections[id];
+  if (s.offset % alignof(T) != 0 || s.offset > f.size ||
+      s.count > (f.size - s.offset) / sizeof(T))
+    return false;
+  auto p = reinterpret_cast<T const *>(f.data + s.offset);
+  out.assign(p, p + s.count);
+  return true;
+}
+
+bool valid_value(CV const &cv, Value v) {
+  if (v.kind > Value::FIT)
+    return false;
+  return v.kind != Value::STYLE ||
+         (v.val_int >= -1 && v.val_int < i32(cv.style.size()));
+}
+
+// the values of the properties in `present`, slot `p` at values[at(p)]
+template <typename At>
+bool valid_props(CV const &cv, u32 present, Value const *values, At at) {
+  if (PROP_COUNT < 32 && present >> PROP_COUNT)
+    return false;
+  for (u32 m = present; m; m &= m - 1) {
+    auto p = PropId(__builtin_ctz(m));
+    auto v = values[at(p)];
+    if (!valid_value(cv, v) || !prop_accepts(p, v))
+      return false;
+  }
+  return true;
+}
+
+// The indices of `cv` all point inside of its arrays, and its layouts are
+// trees, so that what reads it never goes out of bounds nor loops.
+bool valid_cv(CV const &cv) {
+  u32 atoms = cv.symbols.size();
+  auto valid_atom = [&](Atom a) { return a < atoms; };
+  auto valid_var = [&](Atom a) { return a < cv.variable_index.size(); };
+  auto valid_node = [&](u32 n) { return n == NO_NODE || n < cv.nodes.size(); };
+
+  for (auto const &n : cv.nodes) {
+    u32 count = __builtin_popcount(n.props_present);
+    if (!valid_atom(n.kind) || !(n.name == NO_ATOM || valid_atom(n.name)) ||
+        !valid_node(n.first_child) || !valid_node(n.next_sibling) ||
+        n.props_begin > cv.prop_values.size() ||
+        count > cv.prop_values.size() - n.props_begin)
+      return false;
+    auto const *values = cv.prop_values.data() + n.props_begin;
+    PropSlice slice = {n.props_present, values};
+    if (!valid_props(cv, n.props_present, values,
+                     [&](PropId p) { return slice.index(p); }))
+      return false;
+  }
+  for (auto const &s : cv.style) {
+    if (!valid_props(cv, s.values.present, s.values.slots,
+                     [](PropId p) { return p; }))
+      return false;
+  }
+  for (auto const &v : cv.variables) {
+    if (!valid_atom(v.name) || !valid_value(cv, v.val))
+      return false;
+  }
+  if (cv.variable_index.size() > atoms)
+    return false;
+  for (auto i : cv.variable_index) {
+    if (i < -1 || i >= i32(cv.variables.size()))
+      return false;
+  }
+  if (!std::isfinite(cv.format.width) || !std::isfinite(cv.format.height))
+    return false;
+
+  // every node is reached at most once from the roots, with as many
+  // children as it says
+  std::vector<bool> seen(cv.nodes.size());
+  std::vector<u32> stack;
+  for (auto const &l : cv.layout) {
+    if (!valid_atom(l.name) || l.root >= cv.nodes.size())
+      return false;
+    stack.push_back(l.root);
+    while (!stack.empty()) {
+      u32 n = stack.back();
+      stack.pop_back();
+      if (seen[n])
+        return false;
+      seen[n] = true;
+      u32 count = 0;
+      for (u32 c = cv.nodes[n].first_child; c != NO_NODE;
+           c = cv.nodes[c].next_sibling) {
+        if (seen[c] || ++count > cv.nodes.size())
+          return false;
+        stack.push_back(c);
+      }
+      if (count != cv.nodes[n].child_count)
+        return false;
+    }
+  }
+
+  for (auto const &d : cv.decls) {
+    u64 size = d.kind == DeclKind::VAR     ? cv.variables.size()
+               : d.kind == DeclKind::STYLE ? cv.style.size()
+               : d.kind == DeclKind::LAYOUT ? cv.layout.size()
+                                            : 1;
+    if (d.kind > DeclKind::OTHER || d.index >= size || d.begin > d.end ||
+        d.vars_before > cv.variables.size() ||
+        !(d.name == NO_ATOM || valid_atom(d.name)) ||
+        (d.kind == DeclKind::VAR && !valid_var(d.name)))
+      return false;
+    if (!std::all_of(d.deps.begin(), d.deps.end(), valid_atom))
+      return false;
+    for (auto const &r : d.refs) {
+      if (r.value >= cv.prop_values.size() || r.node >= cv.nodes.size() ||
+          r.prop >= PROP_COUNT || !valid_var(r.var))
+        return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+u64 cache_key(u64 source_hash) {
+  // the layout of the sections depends on these
+  u64 format = hash_bytes(__VERSION__, sizeof(__VERSION__) - 1,
+                          CACHE_VERSION ^ (u64(PROP_COUNT) << 32) ^
+                              (sizeof(LayoutNode) << 48));
+  return hash_mix(source_hash ^ format);
+}
+
+std::string cache_path(std::string const &dir, u64 key) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "/%016llx.cvc", key);
+  return dir + name;
+}
+
+bool read_cache(CV &out, u64 key, char const *path) {
+  SourceFile f;
+  if (!f.open(path) || f.size < sizeof(Header))
+    return false;
+  Header h;
+  std::memcpy(&h, f.data, sizeof(h));
+  if (std::memcmp(h.magic, MAGIC, 4) != 0 || h.version != CACHE_VERSION ||
+      h.key != key)
+    return false;
+
+  CV cv;
+  std::vector<u32> name_offsets;
+  std::vector<char> name_chars;
+  std::vector<PageFormat> format;
+  std::vector<DeclRecord> decls;
+  std::vector<Atom> deps;
+  std::vector<VarRef> refs;
+  if (!get_section(f, h, SEC_NAME_OFFSETS, name_offsets) ||
+      !get_section(f, h, SEC_NAME_CHARS, name_chars) ||
+      !get_section(f, h, SEC_LAYOUT, cv.layout) ||
+      !get_section(f, h, SEC_NODES, cv.nodes) ||
+      !get_section(f, h, SEC_PROP_VALUES, cv.prop_values) ||
+      !get_section(f, h, SEC_STYLE, cv.style) ||
+      !get_section(f, h, SEC_VARIABLES, cv.variables) ||
+      !get_section(f, h, SEC_VARIABLE_INDEX, cv.variable_index) ||
+      !get_section(f, h, SEC_FORMAT, format) || format.size() != 1 ||
+      !get_section(f, h, SEC_DECLS, decls) ||
+      !get_section(f, h, SEC_DECL_DEPS, deps) ||
+      !get_section(f, h, SEC_DECL_REFS, refs))
+    return false;
+  cv.format = format[0];
+
+  cv.decls.resize(decls.size());
+  for (u32 i = 0; i < decls.size(); i++) {
+    auto const &r = decls[i];
+    if (r.deps_begin > deps.size() ||
+        r.deps_count > deps.size() - r.deps_begin ||
+        r.refs_begin > refs.size() ||
+        r.refs_count > refs.size() - r.refs_begin)
+      return false;
+    auto &d = cv.decls[i];
+    d.kind = r.kind;
+    d.name = r.name;
+    d.begin = r.begin;
+    d.end = r.end;
+    d.hash = r.hash;
+    d.index = r.index;
+    d.vars_before = r.vars_before;
+    d.node_count = r.node_count;
+    d.deps.assign(deps.begin() + r.deps_begin,
+                  deps.begin() + r.deps_begin + r.deps_count);
+    d.refs.assign(refs.begin() + r.refs_begin,
+                  refs.begin() + r.refs_begin + r.refs_count);
+  }
+
+  // The builtins are already in the table, with the atoms the code uses,
+  // they have to be the ones the file was written with. The rest gets the
+  // same atoms back by being interned in order.
+  u32 builtins = cv.symbols.size();
+  for (u32 i = 0; i + 1 < name_offsets.size(); i++) {
+    u32 b = name_offsets[i], e = name_offsets[i + 1];
+    if (b > e || e > name_chars.size())
+      return false;
+    std::string_view name(name_chars.data() + b, e - b);
+    bool same = i < builtins ? name == cv.symbols.name(i)
+                             : cv.symbols.intern(name) == i;
+    if (!same)
+      return false;
+  }
+  if (name_offsets.size() != cv.symbols.size() + 1 || !valid_cv(cv))
+    return false;
+
+  out = std::move(cv);
+  return true;
+}
+
+bool write_cache(CV const &cv, u64 key, char const *path) {
+  Header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, MAGIC, 4);
+  h.version = CACHE_VERSION;
+  h.key = key;
+
+  std::vector<u32> name_offsets;
+  std::string name_chars;
+  name_offsets.reserve(cv.symbols.size() + 1);
+  for (auto const &name : cv.symbols.names) {
+    name_offsets.push_back(name_chars.size());
+    name_chars += name;
+  }
+  name_offsets.push_back(name_chars.size());
+
+  std::string buf(sizeof(Header), '\0');
+  add_section(buf, h, SEC_NAME_OFFSETS, name_offsets.data(),
+              name_offsets.size());
+  add_section(buf, h, SEC_NAME_CHARS, name_chars.data(), name_chars.size());
+  add_section(buf, h, SEC_LAYOUT, cv.layout.data(), cv.layout.size());
+  add_section(buf, h, SEC_NODES, cv.nodes.data(), cv.nodes.size());
+  add_section(buf, h, SEC_PROP_VALUES, cv.prop_values.data(),
+              cv.prop_values.size());
+  // Style, DeclRecord and VarRef have padding
+  add_records<Style>(buf, h, SEC_STYLE, cv.style.size(),
+                     [&](Style &r, u64 i) {
+                       r.values = cv.style[i].values;
+                       r.document = cv.style[i].document;
+                     });
+  add_section(buf, h, SEC_VARIABLES, cv.variables.data(),
+              cv.variables.size());
+  add_section(buf, h, SEC_VARIABLE_INDEX, cv.variable_index.data(),
+              cv.variable_index.size());
+  add_section(buf, h, SEC_FORMAT, &cv.format, 1);
+
+  std::vector<Atom> deps;
+  std::vector<VarRef> refs;
+  add_records<DeclRecord>(
+      buf, h, SEC_DECLS, cv.decls.size(), [&](DeclRecord &r, u64 i) {
+        auto const &d = cv.decls[i];
+        r.kind = d.kind;
+        r.name = d.name;
+        r.begin = d.begin;
+        r.end = d.end;
+        r.hash = d.hash;
+        r.index = d.index;
+        r.vars_before = d.vars_before;
+        r.node_count = d.node_count;
+        r.deps_begin = deps.size();
+        r.deps_count = d.deps.size();
+        r.refs_begin = refs.size();
+        r.refs_count = d.refs.size();
+        deps.insert(deps.end(), d.deps.begin(), d.deps.end());
+        refs.insert(refs.end(), d.refs.begin(), d.refs.end());
+      });
+  add_section(buf, h, SEC_DECL_DEPS, deps.data(), deps.size());
+  add_records<VarRef>(buf, h, SEC_DECL_REFS, refs.size(),
+                      [&](VarRef &r, u64 i) {
+                        r.value = refs[i].value;
+                        r.node = refs[i].node;
+                        r.var = refs[i].var;
+                        r.prop = refs[i].prop;
+                      });
+  std::memcpy(buf.data(), &h, sizeof(h));
+
+  // several processes can fill the same cache
+  std::string tmp = std::string(path) + "." + std::to_string(getpid());
+  FILE *file = std::fopen(tmp.c_str(), "wb");
+  if (!file)
+    return false;
+  bool ok = std::fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+  ok = std::fclose(file) == 0 && ok;
+  if (ok && std::rename(tmp.c_str(), path) == 0)
+    return true;
+  unlink(tmp.c_str());
+  return false;
+}
+
+void trim_cache(std::string const &dir, u32 keep) {
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+  struct Entry {
+    std::string path;
+    time_t mtime;
+  };
+  std::vector<Entry> entries;
+  while (auto *e = readdir(d)) {
+    std::string_view name = e->d_name;
+    if (name.size() < 4 || name.substr(name.size() - 4) != ".cvc")
+      continue;
+    std::string path = dir + "/" + e->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+      entries.push_back({std::move(path), st.st_mtime});
+  }
+  closedir(d);
+  if (entries.size() <= keep)
+    return;
+  std::sort(entries.begin(), entries.end(),
+            [](Entry const &a, Entry const &b) { return a.mtime > b.mtime; });
+  for (u64 i = keep; i < entries.size(); i++)
+    unlink(entries[i].path.c_str());
+}
@@ -0,0 +1,36 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "filedata.hpp"
+#include <string>
+
+// On-disk cache of parsed documents, so that a source that was already
+// parsed once can be loaded without lexing or parsing it again.
+//
+// The file holds the symbol names, variables, styles, layout tree and
+// declarations of a CV as flat arrays located by offsets from the start of
+// the file, so it can be mapped as is. It is keyed by the content hash of
+// the source and by the version of the format and of the parser that
+// produced it. The declarations are kept so that a document loaded from the
+// cache can still be reparsed incrementally.
+
+// changes whenever the parser or the encoding of a CV changes
+constexpr u32 CACHE_VERSION = 6;
+// entries kept in a cache directory, the least recently written go first
+constexpr u32 CACHE_ENTRIES = 64;
+
+// key of the cache entry for a source with content hash `source_hash`
+u64 cache_key(u64 source_hash);
+// `dir`/<key>.cvc
+std::string cache_path(std::string const &dir, u64 key);
+
+// false if the file is missing, was written for another key or is damaged,
+// an index out of its arrays included
+bool read_cache(CV &out, u64 key, char const *path);
+// written to a temporary file then renamed, so readers never see a partial
+// cache
+bool write_cache(CV const &cv, u64 key, char const *path);
+// removes the oldest entries of `dir` beyond `keep`
+void trim_cache(std::string const &dir, u32 keep);
+
+#endif // !CACHE_HPP
@@ -0,0 +1,39 @@
+#include "decls.hpp"
+#include "scan.hpp"
+
+std::vector<DeclSpan> split_decls(std::string_view src) {
+  std::vector<DeclSpan> out;
+  char const *begin = src.data();
+  char const *end = begin + src.size();
+  char const *pos = begin;
+  while (true) {
+    // skip whitespace and comments up to the first token
+    pos = scanner.skip_space(pos, end);
+    if (pos != end && *pos == '%' && pos + 1 != end && pos[1] == '%') {
+      pos = scanner.find_newline(pos + 2, end);
+      continue;
+    }
+    if (pos == end)
+      break;
+    char const *decl_begin = pos;
+    i32 depth = 0;
+    while (pos != end) {
+      if (!has_class(*pos, CC_DECL)) {
+        pos++;
+        continue;
+      }
+      char c = *pos++;
+      if (c == '{' || c == '(') {
+        depth++;
+      } else if (c == '}' || c == ')') {
+        depth--;
+      } else if (c == '%' && pos != end && *pos == '%') {
+        pos = scanner.find_newline(pos + 1, end);
+      } else if (c == ';' && depth <= 0) {
+        break;
+      }
+    }
+    out.push_back({u32(decl_begin - begin), u32(pos - begin)});
+  }
+  return out;
+}
@@ -0,0 +1,19 @@
+#ifndef DECLS_HPP
+#define DECLS_HPP
+
+#include "../defines.hpp"
+#include <string_view>
+#include <vector>
+
+// Position of a top-level declaration in a source: from its first token up
+// to and including its ';'.
+struct DeclSpan {
+  u32 begin, end;
+};
+
+// Splits a source at the ';' that are outside of braces and parentheses and
+// not in a %% comment, without lexing it. Text after the last ';' is
+// returned as a last span.
+std::vector<DeclSpan> split_decls(std::string_view src);
+
+#endif // !DECLS_HPP
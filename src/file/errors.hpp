@@ -0,0 +1,27 @@
+#ifndef ERRORS_HPP
+#define ERRORS_HPP
+
+#include <string>
+#include <string_view>
+
+// Errors found while reading a document. Every parser reports to its own,
+// so several documents (or parts of one) can be parsed at the same time.
+struct ErrorSink {
+  bool had_error = false;
+  std::string message; // TODO: put message in box
+
+  void report(std::string_view msg) {
+    had_error = true;
+    message += msg;
+  }
+  void append(ErrorSink const &o) {
+    had_error |= o.had_error;
+    message += o.message;
+  }
+  void clear() {
+    had_error = false;
+    message.clear();
+  }
+};
+
+#endif // !ERRORS_HPP
@@ -1,12 +1,53 @@
 #include "filedata.hpp"
 #include <cassert>
-#include <unordered_map>
 
-Value LayoutElem::get_prop(char const *name, Value default_val) const {
-  if (auto it = props.find(name); it != props.end()) {
-    return it->second;
+Value const *CV::find_variable(Atom name) const {
+  if (name >= variable_index.size() || variable_index[name] < 0)
+    return nullptr;
+  return &variables[variable_index[name]].val;
+}
+
+void CV::add_variable(Atom name, Value val) {
+  if (name >= variable_index.size())
+    variable_index.resize(name + 1, -1);
+  // the first declaration of a name is the one that is used
+  if (variable_index[name] < 0)
+    variable_index[name] = variables.size();
+  variables.push_back({name, val});
+}
+
+u32 CV::add_node(Atom kind, Atom name, PropBlock const &props) {
+  LayoutNode n;
+  n.kind = kind;
+  n.name = name;
+  n.props_present = props.present;
+  n.props_begin = prop_values.size();
+  for (u32 m = props.present; m; m &= m - 1) {
+    prop_values.push_back(props.slots[__builtin_ctz(m)]);
   }
-  return default_val;
+  nodes.push_back(n);
+  return nodes.size() - 1;
+}
+
+void CV::add_child(u32 parent, u32 child, u32 &last_child) {
+  if (last_child == NO_NODE)
+    nodes[parent].first_child = child;
+  else
+    nodes[last_child].next_sibling = child;
+  nodes[parent].child_count++;
+  last_child = child;
+}
+
+void CVChanges::append(CVChanges const &o) {
+  nodes.insert(nodes.end(), o.nodes.begin(), o.nodes.end());
+  styles.insert(styles.end(), o.styles.begin(), o.styles.end());
+  layouts.insert(layouts.end(), o.layouts.begin(), o.layouts.end());
+}
+
+void CVChanges::clear() {
+  nodes.clear();
+  styles.clear();
+  layouts.clear();
 }
 
 Value &Value::resolve_units(f32 vw, f32 vh) {
@@ -29,26 +70,15 @@ f32 Value::get_f32(f32 pc_mult) const {
   return val;
 }
 
-std::string error_message; // TODO: put message in box
-bool parsing_had_error;
-
 CV get_error_document() {
-  std::unordered_map<std::string, Value> props;
-  props["background_color"] = Value(Value::COLOR, i32(0xff0000ff));
-  props["padding"] = Value(Value::VW, 10);
-  props["margin"] = Value(Value::VW, 10);
-  props["corner_radius"] = Value(Value::VW, 3);
-  return CV{
-      .width = 1,
-      .height = 1,
-      .layout = {Layout{"%root%",
-                        LayoutElem{
-                            .kind = "box",
-                            .name = "",
-                            .props = props,
-                            .children = {},
-                        }}},
-      .style = {},
-      .variables = {},
-  };
+  PropBlock props;
+  props.set(PROP_BACKGROUND_COLOR, Value(Value::COLOR, i32(0xff0000ff)));
+  props.set(PROP_PADDING, Value(Value::VW, 10));
+  props.set(PROP_MARGIN, Value(Value::VW, 10));
+  props.set(PROP_CORNER_RADIUS, Value(Value::VW, 3));
+  CV out;
+  out.width = 1;
+  out.height = 1;
+  out.layout.push_back({ATOM_ROOT, out.add_node(ATOM_BOX, NO_ATOM, props)});
+  return out;
 }
@@ -2,64 +2,115 @@
 #define FILEDATA_HPP
 
 #include "../defines.hpp"
-#include <optional>
+#include "props.hpp"
+#include "symbols.hpp"
+#include "value.hpp"
 #include <string>
-#include <unordered_map>
 #include <vector>
 
-struct Value { // TODO:
-  enum Kind {
-    PC,
-    VW,
-    VH,
-    NO_UNIT,
-    STYLE,
-    COLOR,
-  } kind;
-  union {
-    f32 val;
-    i32 val_int;
-  };
-  Value() = default;
-  Value(Kind k, f32 val) : kind(k), val(val) {}
-  Value(Kind k, i32 val) : kind(k), val_int(val) {}
-  Value(f32 val) : kind(NO_UNIT), val(val) {}
-  Value &resolve_units(f32 vw, f32 vh);
-  f32 get_f32(f32 pc_mult) const;
-};
+inline constexpr u32 NO_NODE = u32(-1);
 
-struct LayoutElem {
-  std::string kind;
-  std::optional<std::string> name;
-  std::unordered_map<std::string, Value> props;
-  std::vector<LayoutElem> children;
-  Value get_prop(char const *name, Value default_val = 0.f) const;
+// Layout elements of a document live in one array (CV::nodes) and refer to
+// each other by index. The values of the properties set on an element are
+// stored contiguously in CV::prop_values, see PropSlice.
+struct LayoutNode {
+  Atom kind;
+  Atom name = NO_ATOM;
+  u32 first_child = NO_NODE;
+  u32 next_sibling = NO_NODE;
+  u32 child_count = 0;
+  u32 props_present = 0;
+  u32 props_begin = 0;
 };
 
 struct Layout {
-  std::string name;
-  LayoutElem root;
+  Atom name;
+  u32 root;
+};
+
+// Size of the pages in pixels, set by `%format`. A document without one is
+// shown in the window instead, at its size.
+struct PageFormat {
+  f32 width = 0.f, height = 0.f;
+  bool is_set() const { return width > 0.f; }
 };
 
 struct Variable {
-  std::string name;
+  Atom name;
   Value val;
 };
 
 struct Style {
-  std::unordered_map<std::string, Value> values;
+  PropBlock values;
+  // declared without a name, it applies to every element (see StyleCache)
+  bool document = false;
+};
+
+enum class DeclKind : u8 {
+  VAR,
+  STYLE,
+  LAYOUT,
+  OTHER,
+};
+
+// A property value that was read from a variable, so it can be updated in
+// place when only the variable changes
+struct VarRef {
+  u32 value; // index in CV::prop_values
+  u32 node;  // whose property it is
+  Atom var;
+  PropId prop;
+};
+
+// What a top-level declaration produced, used to reparse only the
+// declarations that changed (see Parser::reparse)
+struct DeclInfo {
+  DeclKind kind = DeclKind::OTHER;
+  Atom name = NO_ATOM;
+  u32 begin = 0, end = 0;
+  u64 hash = 0;
+  u32 index = 0;       // in CV::variables, CV::style or CV::layout
+  u32 vars_before = 0; // variables declared before, the ones it can see
+  u32 node_count = 0;
+  std::vector<Atom> deps; // variables it reads
+  std::vector<VarRef> refs;
+};
+
+// What Parser::reparse changed in place, so that only what depends on it is
+// updated (see RenderTree::restyle)
+struct CVChanges {
+  std::vector<u32> nodes;   // whose property values were patched
+  std::vector<u32> styles;  // in CV::style, parsed again
+  std::vector<u32> layouts; // in CV::layout, parsed again
+  bool empty() const {
+    return nodes.empty() && styles.empty() && layouts.empty();
+  }
+  void append(CVChanges const &o);
+  void clear();
 };
 
 struct CV {
   f32 width, height;
+  PageFormat format;
   std::vector<Layout> layout;
+  std::vector<LayoutNode> nodes;
+  std::vector<Value> prop_values;
   std::vector<Style> style;
   std::vector<Variable> variables;
+  SymbolTable symbols;
+  std::vector<DeclInfo> decls;
+  // index in `variables` of the first declaration of each atom, or -1
+  std::vector<i32> variable_index;
+  Value const *find_variable(Atom name) const;
+  void add_variable(Atom name, Value val);
+  u32 add_node(Atom kind, Atom name, PropBlock const &props);
+  void add_child(u32 parent, u32 child, u32 &last_child);
+  PropSlice props(u32 node) const {
+    auto const &n = nodes[node];
+    return {n.props_present, prop_values.data() + n.props_begin};
+  }
 };
 
-extern std::string error_message;
-extern bool parsing_had_error;
-
 CV get_error_document();
 
 #endif // !FILEDATA_HPP
@@ -0,0 +1,40 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include "../defines.hpp"
+#include <cstring>
+#include <string_view>
+
+// 64-bit non-cryptographic hash, reads 8 bytes at a time. Used to detect
+// changed sources, so it only has to be fast and well distributed.
+inline u64 hash_mix(u64 h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+inline u64 hash_bytes(void const *data, u64 size, u64 seed = 0) {
+  auto p = static_cast<unsigned char const *>(data);
+  u64 h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+  while (size >= 8) {
+    u64 v;
+    std::memcpy(&v, p, 8);
+    h = (h ^ hash_mix(v)) * 0x9e3779b97f4a7c15ull;
+    p += 8;
+    size -= 8;
+  }
+  u64 v = 0;
+  if (size)
+    std::memcpy(&v, p, size);
+  h = (h ^ hash_mix(v)) * 0x9e3779b97f4a7c15ull;
+  return hash_mix(h);
+}
+
+inline u64 hash_bytes(std::string_view s, u64 seed = 0) {
+  return hash_bytes(s.data(), s.size(), seed);
+}
+
+#endif // !HASH_HPP
@@ -1,146 +1,305 @@
 #include "lexer.hpp"
 #include "filedata.hpp"
-#include <cctype>
-#include <fstream>
+#include "scan.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
 
-std::string read_entire_file(char const *filename) {
-  std::ifstream ifs(filename);
-  ifs.seekg(0, std::ios::end);
-  auto size = ifs.tellg();
-  ifs.seekg(0, std::ios::beg);
-  std::string out(size, '\0');
-  ifs.read(out.data(), out.size());
-  ifs.close();
-  return out;
+bool Lexer::open_file(char const *filename) {
+  SourceFile src;
+  if (!src.open(filename))
+    return false;
+  open_source(filename, std::move(src));
+  return true;
 }
 
-void Lexer::open_file(char const *filename) {
+void Lexer::open_source(char const *filename, SourceFile &&src) {
   this->filename = filename;
-  file_contents = read_entire_file(filename);
-  file_contents += '\0';
-  begin = file_contents.data();
-  end = begin + file_contents.size() - 1;
+  source = std::move(src);
+  begin = source.data;
+  end = begin + source.size;
   cur_pos = begin;
+  begin_loc = 0;
+  begin_line = begin_column = 1;
+}
+
+void Lexer::open_range(char const *base, u32 from, u32 to) {
+  begin = base;
+  begin_loc = 0;
+  begin_line = begin_column = 1;
+  cur_pos = base + from;
+  end = base + to;
+  queue_count = 0;
+  pretokenized = false;
+}
+
+void Lexer::open_fd(char const *filename, int fd) {
+  this->filename = filename;
+  source.close();
+  this->fd = fd;
+  eof = false;
+  in_comment = false;
+  buffer = std::make_unique<char[]>(STREAM_BUFFER_SIZE);
+  begin = cur_pos = end = buffer.get();
+  begin_loc = 0;
+  begin_line = begin_column = 1;
+  queue_count = 0;
+  pretokenized = false;
+}
+
+// `line` and `column` moved past the text [p, end)
+void count_lines(char const *p, char const *end, u32 &line, u32 &column) {
+  for (; p != end; p++) {
+    if (*p == '\n') {
+      line++;
+      column = 1;
+    } else {
+      column++;
+    }
+  }
+}
+
+bool Lexer::line_column(Loc loc, u32 &line, u32 &column) const {
+  if (loc < begin_loc || loc - begin_loc > end - begin)
+    return false;
+  line = begin_line;
+  column = begin_column;
+  count_lines(begin, begin + (loc - begin_loc), line, column);
+  return true;
+}
+
+// Makes at least MAX_TOKEN_SIZE bytes available after cur_pos, unless the
+// stream ends before. `can_move` is true when no token points into the
+// buffer anymore.
+void refill(Lexer &l, bool can_move) {
+  if (!l.streaming() || l.eof || l.end - l.cur_pos >= Lexer::MAX_TOKEN_SIZE)
+    return;
+  char *buf = l.buffer.get();
+  char *buf_end = buf + Lexer::STREAM_BUFFER_SIZE;
+  u32 unread = l.end - l.cur_pos;
+  if (can_move || buf_end - l.cur_pos < Lexer::MAX_TOKEN_SIZE) {
+    count_lines(l.begin, l.cur_pos, l.begin_line, l.begin_column);
+    if (can_move) {
+      std::memmove(buf, l.cur_pos, unread);
+      l.retired.clear();
+    } else {
+      l.retired.push_back(std::move(l.buffer));
+      l.buffer = std::make_unique<char[]>(Lexer::STREAM_BUFFER_SIZE);
+      buf = l.buffer.get();
+      buf_end = buf + Lexer::STREAM_BUFFER_SIZE;
+      std::memcpy(buf, l.cur_pos, unread);
+    }
+    l.begin_loc += l.cur_pos - l.begin;
+    l.begin = l.cur_pos = buf;
+    l.end = buf + unread;
+  }
+
+  char *pos = buf + (l.end - l.begin);
+  while (pos - l.cur_pos < Lexer::MAX_TOKEN_SIZE && pos != buf_end) {
+    auto n = read(l.fd, pos, buf_end - pos);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      if (n < 0 && l.errors) {
+        l.errors->report("could not read file '");
+        l.errors->message += l.filename;
+        l.errors->message += "'\n";
+      }
+      l.eof = true;
+      break;
+    }
+    pos += n;
+  }
+  l.end = pos;
 }
 
 void skip_whitespace(Lexer &l) {
-  while (l.cur_pos != l.end && std::isspace(*l.cur_pos))
-    l.cur_pos++;
+  l.cur_pos = scanner.skip_space(l.cur_pos, l.end);
 }
 
-Token finish_token(Lexer &l, char *end_pos, Tok kind) {
+Token finish_token(Lexer &l, char const *end_pos, Tok kind) {
+  // only a token longer than the refill window reaches the end of it
+  if (end_pos == l.end && l.streaming() && !l.eof && l.errors)
+    l.errors->report("token too long\n");
   auto size = end_pos - l.cur_pos;
-  auto loc = Loc(l.cur_pos - l.begin);
+  auto loc = Loc(l.cur_pos - l.begin) + l.begin_loc;
   std::string_view data = std::string_view(l.cur_pos, size);
   l.cur_pos = end_pos;
   return {kind, data, loc};
 }
 
-bool is_identifier_start(char c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
-}
-bool is_identifier_continue(char c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
-         (c >= '0' && c <= '9') || c == '_';
-}
-
-Token finish_ident_token(Lexer &l, char *pos) {
-  while (is_identifier_continue(*pos))
-    pos++;
-  return finish_token(l, pos, Tok::IDENT);
+Token finish_ident_token(Lexer &l, char const *pos) {
+  auto t = finish_token(l, scanner.skip_ident(pos, l.end), Tok::IDENT);
+  if (l.symbols)
+    t.atom = l.symbols->intern(t.value);
+  return t;
 }
 
-Token finish_num_token(Lexer &l, char *pos) {
-  while (*pos >= '0' && *pos <= '9')
-    pos++;
-  return finish_token(l, pos, Tok::NUMBER);
+Token finish_num_token(Lexer &l, char const *pos) {
+  return finish_token(l, scanner.skip_digits(pos, l.end), Tok::NUMBER);
 }
 
-Token finish_color_token(Lexer &l, char *pos) {
-  while ((*pos >= '0' && *pos <= '9') || (*pos >= 'A' && *pos <= 'F') ||
-         (*pos >= 'a' && *pos <= 'f'))
-    pos++;
-  return finish_token(l, pos, Tok::COLOR);
+Token finish_color_token(Lexer &l, char const *pos) {
+  return finish_token(l, scanner.skip_hex(pos, l.end), Tok::COLOR);
 }
 
-void Lexer::enter_token(Token const &t) { cached_tokens.push_back(t); }
-
-void skip_until_newline(Lexer &l, char *pos) {
-  while (*pos != '\n' && *pos != '\r')
-    pos++;
+void skip_until_newline(Lexer &l, char const *pos) {
+  pos = scanner.find_newline(pos, l.end);
+  if (pos == l.end) {
+    l.cur_pos = pos;
+    // continued after the next refill
+    l.in_comment = l.streaming() && !l.eof;
+    return;
+  }
   // maybe allow escaping newlines with '\'
-  if (*pos == '\n' && *(pos + 1) == '\r')
+  if (pos + 1 != l.end && *pos == '\n' && *(pos + 1) == '\r')
     pos++;
-  else if (*pos == '\r' && *(pos + 1) == '\n')
+  else if (pos + 1 != l.end && *pos == '\r' && *(pos + 1) == '\n')
     pos++;
   l.cur_pos = pos + 1;
 }
 
-Token lex_no_cache(Lexer &l) {
-  skip_whitespace(l);
-  char *pos = l.cur_pos;
-  char c = *pos++;
-  switch (c) {
-  case '\0':
-    return finish_token(l, pos, Tok::END);
-  case '%':
-    if (*pos == '%') {
-      // line comment
-      skip_until_newline(l, pos + 1);
-      return lex_no_cache(l);
+Token lex_no_cache(Lexer &l, bool can_move = false) {
+  while (true) {
+    refill(l, can_move);
+    if (l.in_comment) {
+      l.in_comment = false;
+      skip_until_newline(l, l.cur_pos);
+      continue;
     }
-    return finish_token(l, pos, Tok::PERCENT);
-  case '$':
-    return finish_token(l, pos, Tok::DOLLAR);
-  case '=':
-    return finish_token(l, pos, Tok::EQUAL);
-  case ';':
-    return finish_token(l, pos, Tok::SEMI);
-  case ',':
-    return finish_token(l, pos, Tok::COMMA);
-  case '(':
-    return finish_token(l, pos, Tok::LPAREN);
-  case ')':
-    return finish_token(l, pos, Tok::RPAREN);
-  case '{':
-    return finish_token(l, pos, Tok::LBRACE);
-  case '}':
-    return finish_token(l, pos, Tok::RBRACE);
-  case '#':
-    return finish_color_token(l, pos);
-  case '0':
-  case '1':
-  case '2':
-  case '3':
-  case '4':
-  case '5':
-  case '6':
-  case '7':
-  case '8':
-  case '9':
-    return finish_num_token(l, pos);
-  default:
-    if (is_identifier_start(c)) {
-      return finish_ident_token(l, pos);
+    skip_whitespace(l);
+    if (l.streaming() && !l.eof &&
+        l.end - l.cur_pos < Lexer::MAX_TOKEN_SIZE) {
+      // whitespace up to the end of the window
+      continue;
     }
-    parsing_had_error = true;
-    error_message += "unknown character 'c' in file\n"; // TODO: actually put character and put location
+    if (l.cur_pos == l.end)
+      return finish_token(l, l.end, Tok::END);
+    char const *pos = l.cur_pos;
+    char c = *pos++;
+    switch (c) {
+    case '\0':
+      return finish_token(l, pos, Tok::END);
+    case '%':
+      if (pos != l.end && *pos == '%') {
+        // line comment
+        skip_until_newline(l, pos + 1);
+        continue;
+      }
+      return finish_token(l, pos, Tok::PERCENT);
+    case '$':
+      return finish_token(l, pos, Tok::DOLLAR);
+    case '=':
+      return finish_token(l, pos, Tok::EQUAL);
+    case ';':
+      return finish_token(l, pos, Tok::SEMI);
+    case ',':
+      return finish_token(l, pos, Tok::COMMA);
+    case '(':
+      return finish_token(l, pos, Tok::LPAREN);
+    case ')':
+      return finish_token(l, pos, Tok::RPAREN);
+    case '{':
+      return finish_token(l, pos, Tok::LBRACE);
+    case '}':
+      return finish_token(l, pos, Tok::RBRACE);
+    case '#':
+      return finish_color_token(l, pos);
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      return finish_num_token(l, pos);
+    default:
+      if (has_class(c, CC_IDENT_START)) {
+        return finish_ident_token(l, pos);
+      }
+      if (l.errors) {
+        l.errors->report("unknown character '");
+        l.errors->message += c;
+        l.errors->message += "' in file\n"; // TODO: put location
+      }
+      // skip it, so that lexing can go on
+      l.cur_pos = pos;
+      continue;
+    }
+  }
+}
+
+void Lexer::pretokenize() {
+  tokens.clear();
+  // roughly one token every 6 bytes of source
+  tokens.reserve(source.size / 6 + 16);
+  while (true) {
+    Token t = lex_no_cache(*this);
+    if (t.value.size() >= (1u << 24)) {
+      if (errors)
+        errors->report("token too long\n");
+      t.value = t.value.substr(0, (1u << 24) - 1);
+    }
+    u32 extra = t.atom != NO_ATOM ? t.atom : u32(t.value.size());
+    tokens.push_back({u32(t.loc), extra, u32(t.kind)});
+    if (t.kind == Tok::END)
+      break;
+  }
+  cursor = 0;
+  pretokenized = true;
+}
+
+Token Lexer::token_at(u32 i) const {
+  // everything past the end reads as the END token
+  if (i >= tokens.size())
+    i = tokens.size() - 1;
+  auto t = tokens[i];
+  if (Tok(t.kind) == Tok::IDENT && symbols) {
+    Atom a = t.length_or_atom;
+    return {Tok::IDENT,
+            std::string_view(begin + t.offset, symbols->name(a).size()),
+            Loc(t.offset), a};
+  }
+  return {Tok(t.kind), std::string_view(begin + t.offset, t.length_or_atom),
+          Loc(t.offset)};
+}
+
+void Lexer::enter_token(Token const &t) {
+  if (pretokenized) {
+    assert(cursor > 0 && token_at(cursor - 1).loc == t.loc);
+    cursor--;
+    return;
   }
-  return {};
+  assert(queue_count < QUEUE_SIZE);
+  queue_head = (queue_head - 1) % QUEUE_SIZE;
+  queue[queue_head] = t;
+  queue_count++;
 }
 
 Token Lexer::lex() {
-  if (cached_tokens.size() > 0) {
-    Token out = cached_tokens.back();
-    cached_tokens.pop_back();
+  if (pretokenized)
+    return token_at(cursor++);
+  if (queue_count > 0) {
+    Token out = queue[queue_head];
+    queue_head = (queue_head + 1) % QUEUE_SIZE;
+    queue_count--;
     return out;
   }
-  return lex_no_cache(*this);
+  return lex_no_cache(*this, true);
 }
 
-Token const &Lexer::look_ahead(u32 n) {
-  for (i32 i = 0; i < i32(n) - i32(cached_tokens.size()); i++) {
-    cached_tokens.insert(cached_tokens.begin(), lex_no_cache(*this));
+Token Lexer::look_ahead(u32 n) {
+  assert(n >= 1);
+  if (pretokenized)
+    return token_at(cursor + n - 1);
+  assert(n <= QUEUE_SIZE);
+  while (queue_count < n) {
+    queue[(queue_head + queue_count) % QUEUE_SIZE] = lex_no_cache(*this);
+    queue_count++;
   }
-  return cached_tokens[cached_tokens.size() - n];
+  return queue[(queue_head + n - 1) % QUEUE_SIZE];
 }
@@ -2,6 +2,10 @@
 #define LEXER_HPP
 
 #include "../defines.hpp"
+#include "errors.hpp"
+#include "source.hpp"
+#include "symbols.hpp"
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -29,19 +33,73 @@ struct Token {
   Tok kind;
   std::string_view value;
   Loc loc;
+  // identifiers are interned when lexed, if the lexer has a symbol table
+  Atom atom = NO_ATOM;
 };
 
+// Token as stored in the flat token stream: the text is recovered from the
+// source with offset/length. Interned identifiers store their atom instead
+// of the length, which is the length of the atom's name.
+struct PackedToken {
+  u32 offset;
+  u32 length_or_atom : 24;
+  u32 kind : 8;
+};
+static_assert(sizeof(PackedToken) == 8);
+
 struct Lexer {
   std::string filename;
-  std::string file_contents;
-  char *begin;
-  char *cur_pos;
-  char *end;
-  std::vector<Token> cached_tokens;
-  void open_file(char const *filename);
+  SourceFile source;
+  char const *begin;
+  char const *cur_pos;
+  char const *end;
+  SymbolTable *symbols = nullptr;
+  // where errors are reported, if anywhere
+  ErrorSink *errors = nullptr;
+
+  // tokens looked ahead but not consumed yet
+  static constexpr u32 QUEUE_SIZE = 16;
+  Token queue[QUEUE_SIZE];
+  u32 queue_head = 0;
+  u32 queue_count = 0;
+
+  // whole file tokenized up front by pretokenize(), walked with `cursor`
+  bool pretokenized = false;
+  std::vector<PackedToken> tokens;
+  u32 cursor = 0;
+
+  // Streaming from a file descriptor: only a window of the input is kept in
+  // `buffer`, which starts at location `begin_loc` of the stream. It is
+  // refilled when less than MAX_TOKEN_SIZE bytes are left, by moving the
+  // unread bytes to its front if no token points into it, or else by
+  // copying them to a new buffer while the old one stays alive in `retired`
+  // until the tokens are consumed.
+  static constexpr u32 STREAM_BUFFER_SIZE = 64 * 1024;
+  static constexpr u32 MAX_TOKEN_SIZE = 4 * 1024;
+  int fd = -1;
+  bool eof = false;
+  bool in_comment = false;
+  Loc begin_loc = 0;
+  // of `begin_loc`, from 1, counted in what the window leaves behind
+  u32 begin_line = 1, begin_column = 1;
+  std::unique_ptr<char[]> buffer;
+  std::vector<std::unique_ptr<char[]>> retired;
+
+  bool open_file(char const *filename);
+  void open_source(char const *filename, SourceFile &&src);
+  // reads `fd` in chunks while lexing, it is not closed
+  void open_fd(char const *filename, int fd);
+  bool streaming() const { return fd >= 0; }
+  // lex only [from, to) of a buffer owned by someone else
+  void open_range(char const *base, u32 from, u32 to);
+  void pretokenize();
+  Token token_at(u32 i) const;
   void enter_token(Token const &t);
-  Token const &look_ahead(u32 n);
+  Token look_ahead(u32 n);
   Token lex();
+  // Line and column of `loc`, from 1, for error messages. False if its
+  // text is no longer there, streamed before the window.
+  bool line_column(Loc loc, u32 &line, u32 &column) const;
 };
 
 #endif // !LEXER_HPP
@@ -1,9 +1,11 @@
 #include "parser.hpp"
+#include "decls.hpp"
 #include "filedata.hpp"
+#include "hash.hpp"
 #include <cassert>
 #include <cstring>
 #include <iostream>
-#include <optional>
+#include <thread>
 
 int parse_color_token(std::string_view value) {
   assert(value[0] == '#');
@@ -62,10 +64,13 @@ int parse_num_token(std::string_view value) {
   return res;
 }
 
-Value get_variable(CV &out, std::string_view name) {
-  for (auto const &v : out.variables) {
-    if (v.name == name)
-      return v.val;
+Value get_variable(Parser &p, CV &out, Atom name) {
+  if (p.decl)
+    p.decl->deps.push_back(name);
+  if (name < out.variable_index.size() &&
+      u32(out.variable_index[name]) < p.visible_vars) {
+    if (auto v = out.find_variable(name))
+      return *v;
   }
   // ERROR
   return {};
@@ -78,7 +83,7 @@ Value parse_value(Parser &p, CV &out) {
     return Value(Value::COLOR, i32(val));
   } else if (p.tok.kind == Tok::DOLLAR) {
     p.consume_token();
-    auto val = get_variable(out, p.tok.value);
+    auto val = get_variable(p, out, p.tok.atom);
     p.expect_and_consume(Tok::IDENT);
     return val;
   } else if (p.tok.kind == Tok::NUMBER) {
@@ -89,98 +94,161 @@ Value parse_value(Parser &p, CV &out) {
     if (p.tok.kind == Tok::PERCENT) {
       p.consume_token();
       kind = Value::PC;
-    } else if (p.tok.kind == Tok::IDENT && p.tok.value == "vw") {
+    } else if (p.tok.kind == Tok::IDENT && p.tok.atom == ATOM_VW) {
       p.consume_token();
       kind = Value::VW;
-    } else if (p.tok.kind == Tok::IDENT && p.tok.value == "vh") {
+    } else if (p.tok.kind == Tok::IDENT && p.tok.atom == ATOM_VH) {
       p.consume_token();
       kind = Value::VH;
     }
     return Value(kind, f32(val));
+  } else if (p.tok.kind == Tok::IDENT && p.tok.atom == ATOM_FIT) {
+    p.consume_token();
+    return Value(Value::FIT, 0.f);
   }
   // error
   return {};
 }
 
 void parse_vardecl(Parser &p, CV &out) {
-  std::string_view var_name = p.tok.value;
+  Atom var_name = p.tok.atom;
+  if (p.decl) {
+    p.decl->kind = DeclKind::VAR;
+    p.decl->name = var_name;
+    p.decl->index = out.variables.size();
+  }
   p.expect_and_consume(Tok::IDENT);
   p.expect_and_consume(Tok::EQUAL);
   auto value = parse_value(p, out);
-  out.variables.push_back({std::string(var_name), value});
+  out.add_variable(var_name, value);
   p.expect_and_consume(Tok::SEMI);
 }
 
-void parse_style_rule(Parser &p, CV &out, Style &out_style) {
-  auto name = p.tok.value;
+// ends the message of an error found at `loc`
+void report_location(Parser &p, Loc loc) {
+  u32 line, column;
+  if (p.l.line_column(loc, line, column)) {
+    p.errors.message += " at line " + std::to_string(line) + ", column " +
+                        std::to_string(column);
+  }
+  p.errors.message += "\n";
+}
+
+// `slot_vars`, if given, receives the variable each property was read from
+void parse_prop(Parser &p, CV &out, PropBlock &props,
+                Atom *slot_vars = nullptr) {
+  auto name = p.tok;
+  // the token's text can be gone once the value is read from a stream, so
+  // identifiers are named from the symbol table
+  std::string not_ident;
+  if (name.kind != Tok::IDENT)
+    not_ident = name.value;
+  auto name_text = [&]() -> std::string_view {
+    if (name.kind == Tok::IDENT)
+      return p.l.symbols->name(name.atom);
+    return not_ident;
+  };
   p.expect_and_consume(Tok::IDENT);
   p.expect_and_consume(Tok::EQUAL);
+  Atom var = NO_ATOM;
+  if (p.tok.kind == Tok::DOLLAR)
+    var = p.next_token().atom;
   auto value = parse_value(p, out);
-  out_style.values[std::string(name)] = value;
+  if (name.kind != Tok::IDENT)
+    return;
+  auto id = prop_of_atom(name.atom);
+  if (id == PROP_NONE) {
+    p.errors.report("unknown property '");
+    p.errors.message += name_text();
+    p.errors.message += "'";
+    report_location(p, name.loc);
+  } else if (!prop_accepts(id, value)) {
+    p.errors.report("wrong kind of value for property '");
+    p.errors.message += name_text();
+    p.errors.message += "'";
+    report_location(p, name.loc);
+  } else {
+    props.set(id, value);
+    if (slot_vars)
+      slot_vars[id] = var;
+  }
+}
+
+void parse_style_rule(Parser &p, CV &out, Style &out_style) {
+  parse_prop(p, out, out_style.values);
   p.expect_and_consume(Tok::SEMI);
 }
 
-void parse_style(Parser &p, CV &out, std::optional<std::string_view> name) {
+void parse_style(Parser &p, CV &out, Atom name) {
+  if (p.decl) {
+    p.decl->kind = DeclKind::STYLE;
+    p.decl->index = out.style.size();
+  }
   p.expect_and_consume(Tok::LBRACE);
   Style s;
+  s.document = name == NO_ATOM;
   while (p.tok.kind != Tok::RBRACE) {
     parse_style_rule(p, out, s);
   }
   p.expect_and_consume(Tok::RBRACE);
   out.style.push_back(s);
-  if (name) {
-    out.variables.push_back(
-        {std::string(*name), {Value::STYLE, i32(out.style.size() - 1)}});
+  if (name != NO_ATOM) {
+    out.add_variable(name, {Value::STYLE, i32(out.style.size() - 1)});
   }
   return;
 }
 
-void parse_prop_list(Parser &p, CV &out, LayoutElem &elt) {
+void parse_prop_list(Parser &p, CV &out, PropBlock &props, Atom *slot_vars) {
   if (p.tok.kind == Tok::RPAREN)
     return;
-  auto name = p.tok.value;
-  p.expect_and_consume(Tok::IDENT);
-  p.expect_and_consume(Tok::EQUAL);
-  elt.props[std::string(name)] = parse_value(p, out);
+  parse_prop(p, out, props, slot_vars);
   while (p.tok.kind == Tok::COMMA) {
     p.consume_token();
     if (p.tok.kind == Tok::RPAREN)
       break;
-    auto name = p.tok.value;
-    p.expect_and_consume(Tok::IDENT);
-    p.expect_and_consume(Tok::EQUAL);
-    elt.props[std::string(name)] = parse_value(p, out);
+    parse_prop(p, out, props, slot_vars);
   }
 }
 
-LayoutElem parse_layout_elt(Parser &p, CV &out);
+u32 parse_layout_elt(Parser &p, CV &out);
 
-void parse_elt_list(Parser &p, CV &out, LayoutElem &elt) {
+void parse_elt_list(Parser &p, CV &out, u32 elt) {
   if (p.tok.kind == Tok::RBRACE)
     return;
-  elt.children.push_back(parse_layout_elt(p, out));
+  u32 last_child = NO_NODE;
+  out.add_child(elt, parse_layout_elt(p, out), last_child);
   while (p.tok.kind == Tok::COMMA) {
     p.consume_token();
     if (p.tok.kind == Tok::RBRACE)
       break;
-    elt.children.push_back(parse_layout_elt(p, out));
+    out.add_child(elt, parse_layout_elt(p, out), last_child);
   }
 }
 
-LayoutElem parse_layout_elt(Parser &p, CV &out) {
-  LayoutElem elt;
-  elt.kind = p.tok.value;
+u32 parse_layout_elt(Parser &p, CV &out) {
+  Atom kind = p.tok.atom;
   p.expect_and_consume(Tok::IDENT);
-  elt.name = std::nullopt;
+  Atom name = NO_ATOM;
   if (p.tok.kind == Tok::IDENT) {
-    elt.name = p.tok.value;
+    name = p.tok.atom;
     p.consume_token();
   }
+  PropBlock props;
+  Atom slot_vars[PROP_COUNT];
   if (p.tok.kind == Tok::LPAREN) {
     p.consume_token();
-    parse_prop_list(p, out, elt);
+    parse_prop_list(p, out, props, slot_vars);
     p.expect_and_consume(Tok::RPAREN);
   }
+  u32 elt = out.add_node(kind, name, props);
+  if (p.decl) {
+    u32 i = out.nodes[elt].props_begin;
+    for (u32 m = props.present; m; m &= m - 1, i++) {
+      auto slot = PropId(__builtin_ctz(m));
+      if (slot_vars[slot] != NO_ATOM)
+        p.decl->refs.push_back({i, elt, slot_vars[slot], slot});
+    }
+  }
   if (p.tok.kind == Tok::LBRACE) {
     p.consume_token();
     parse_elt_list(p, out, elt);
@@ -189,41 +257,121 @@ LayoutElem parse_layout_elt(Parser &p, CV &out) {
   return elt;
 }
 
-void parse_layout(Parser &p, CV &out, std::optional<std::string_view> name) {
+void parse_layout(Parser &p, CV &out, Atom name) {
+  if (p.decl) {
+    p.decl->kind = DeclKind::LAYOUT;
+    p.decl->index = out.layout.size();
+  }
+  u32 nodes_before = out.nodes.size();
   auto root_elt = parse_layout_elt(p, out);
-  std::string layout_name = "%root%";
-  if (name)
-    layout_name = *name;
+  if (p.decl)
+    p.decl->node_count = out.nodes.size() - nodes_before;
+  Atom layout_name = ATOM_ROOT;
+  if (name != NO_ATOM)
+    layout_name = name;
   out.layout.push_back({layout_name, root_elt});
 }
 
+// A paper size, then optionally its orientation: `%format = A4 landscape;`
+void parse_format(Parser &p, CV &out) {
+  // at 150 dpi, A4 is the size of the window by default
+  struct Paper {
+    Atom name;
+    f32 width, height;
+  };
+  static constexpr Paper PAPERS[] = {
+      {ATOM_A3, 1754, 2480},
+      {ATOM_A4, 1240, 1754},
+      {ATOM_A5, 874, 1240},
+      {ATOM_LETTER, 1275, 1650},
+  };
+  Atom size = p.tok.atom;
+  if (p.expect_and_consume(Tok::IDENT))
+    return;
+  PageFormat format;
+  for (auto const &paper : PAPERS) {
+    if (paper.name == size)
+      format = {paper.width, paper.height};
+  }
+  if (!format.is_set()) {
+    p.errors.report("unknown page format '");
+    p.errors.message += p.l.symbols->name(size);
+    p.errors.message += "'\n";
+    return;
+  }
+  if (p.tok.kind == Tok::IDENT) {
+    if (p.tok.atom == ATOM_LANDSCAPE)
+      std::swap(format.width, format.height);
+    else if (p.tok.atom != ATOM_PORTRAIT) {
+      p.errors.report("expected portrait or landscape, got '");
+      p.errors.message += p.l.symbols->name(p.tok.atom);
+      p.errors.message += "'\n";
+    }
+    p.consume_token();
+  }
+  out.format = format;
+}
+
 void parse_pcdecl(Parser &p, CV &out) {
   p.expect_and_consume(Tok::PERCENT);
   auto tok = p.tok;
   p.expect_and_consume(Tok::IDENT);
-  std::optional<std::string_view> name = std::nullopt;
+  Atom name = NO_ATOM;
   if (p.tok.kind == Tok::IDENT) {
-    name = p.tok.value;
+    name = p.tok.atom;
     p.consume_token();
   }
+  if (p.decl)
+    p.decl->name = name;
   p.expect_and_consume(Tok::EQUAL);
-  if (tok.value == "style") {
+  if (tok.atom == ATOM_STYLE) {
     parse_style(p, out, name);
-  } else if (tok.value == "layout") {
+  } else if (tok.atom == ATOM_LAYOUT) {
     parse_layout(p, out, name);
+  } else if (tok.atom == ATOM_FORMAT) {
+    parse_format(p, out);
   } else {
     // ERROR
   }
   p.expect_and_consume(Tok::SEMI);
 }
 
+DeclInfo parse_decl(Parser &p, CV &out) {
+  DeclInfo d;
+  d.begin = p.tok.loc;
+  d.vars_before = out.variables.size();
+  p.decl = &d;
+  if (p.tok.kind == Tok::PERCENT)
+    parse_pcdecl(p, out);
+  else
+    parse_vardecl(p, out);
+  p.decl = nullptr;
+  d.end = p.prev_tok_location + 1;
+  // a stream does not keep the text
+  if (!p.l.streaming())
+    d.hash = hash_bytes(p.l.begin + d.begin, d.end - d.begin);
+  return d;
+}
+
 void Parser::unconsume_token(Token const &t) {
+  if (l.pretokenized) {
+    // tok is the token just before the cursor, step back over it
+    backtrack(l.cursor - 1);
+    assert(tok.loc == t.loc);
+    return;
+  }
   auto next_tok = tok;
   l.enter_token(t);
   tok = l.lex();
   l.enter_token(next_tok);
 }
 
+void Parser::backtrack(u32 save_point) {
+  assert(l.pretokenized && save_point > 0);
+  l.cursor = save_point;
+  tok = l.token_at(save_point - 1);
+}
+
 Loc Parser::consume_token() {
   prev_tok_location = tok.loc;
   tok = l.lex();
@@ -244,8 +392,7 @@ bool Parser::expect_and_consume(Tok expected, std::string_view) {
     consume_token();
     return false;
   }
-  error_message += "expected ...\n"; // TODO: actual error message
-  parsing_had_error = true;
+  errors.report("expected ...\n"); // TODO: actual error message
   consume_token();
   return true;
 }
@@ -278,24 +425,309 @@ void Parser::skip_until(std::span<Tok> until_toks) {
 }
 
 CV Parser::read_cv_file(char const *filename) {
-  l.open_file(filename);
+  SourceFile src;
+  if (!src.open(filename)) {
+    errors.report("could not open file '");
+    errors.message += filename;
+    errors.message += "'\n";
+  }
+  return read_cv_source(filename, std::move(src));
+}
 
-  tok = l.lex();
+void parse_decls(Parser &p, CV &out) {
+  p.tok = p.l.lex();
+  while (true) {
+    if (p.tok.kind == Tok::PERCENT || p.tok.kind == Tok::IDENT) {
+      out.decls.push_back(parse_decl(p, out));
+    } else if (p.tok.kind == Tok::END) {
+      break;
+    } else {
+      p.errors.report("EXPECTED '%' or id\n"); // TODO: better error message
+      p.consume_token();
+    }
+  }
+}
 
-  CV out;
+// Declarations parsed by one thread, with their own arrays and symbol table
+struct DeclChunk {
+  u32 first, last; // in the declaration spans
+  CV cv;
+  std::vector<DeclInfo> decls;
+  ErrorSink errors;
+};
 
-  while (true) {
-    if (tok.kind == Tok::PERCENT) {
-      parse_pcdecl(*this, out);
-    } else if (tok.kind == Tok::IDENT) {
-      parse_vardecl(*this, out);
-    } else if (tok.kind == Tok::END) {
+void parse_chunk(DeclChunk &c, char const *src,
+                 std::span<DeclSpan const> spans,
+                 std::vector<DeclInfo> const &decls,
+                 std::vector<u32> const &vars_before) {
+  Parser p;
+  for (u32 i = c.first; i < c.last; i++) {
+    if (decls[i].kind == DeclKind::VAR || decls[i].kind == DeclKind::OTHER)
+      continue;
+    p.l.open_range(src, spans[i].begin, spans[i].end);
+    p.l.symbols = &c.cv.symbols;
+    p.visible_vars = vars_before[i];
+    p.tok = p.l.lex();
+    c.decls.push_back(parse_decl(p, c.cv));
+    if (p.tok.kind != Tok::END)
+      p.errors.report("EXPECTED '%' or id\n");
+    if (p.errors.had_error)
       break;
+  }
+  c.errors = std::move(p.errors);
+}
+
+// Parses the declarations of `src` on `n_threads` threads: the variables
+// are declared first, in order, then the styles and layouts are parsed in
+// contiguous chunks that only read them, then the chunks are appended to
+// `out`. Returns false on any error, the sequential parse reports them in
+// order.
+bool parse_parallel(CV &out, std::string_view src, u32 n_threads) {
+  auto spans = split_decls(src);
+  if (spans.size() < 2 * n_threads)
+    return false;
+
+  std::vector<DeclInfo> decls(spans.size());
+  std::vector<u32> vars_before(spans.size());
+  u32 n_styles = 0;
+  Parser p;
+  for (u32 i = 0; i < spans.size(); i++) {
+    p.l.open_range(src.data(), spans[i].begin, spans[i].end);
+    p.l.symbols = &out.symbols;
+    p.tok = p.l.lex();
+    vars_before[i] = out.variables.size();
+    if (p.tok.kind == Tok::IDENT ||
+        (p.tok.kind == Tok::PERCENT && p.l.look_ahead(1).atom == ATOM_FORMAT)) {
+      // they are whole here, the chunks skip them
+      decls[i] = parse_decl(p, out);
+      if (p.tok.kind != Tok::END)
+        return false;
+    } else if (p.tok.kind == Tok::PERCENT) {
+      // only the header, the variable a named style declares comes after
+      // its body
+      p.consume_token();
+      Atom kind = p.tok.atom;
+      p.expect_and_consume(Tok::IDENT);
+      decls[i].kind = kind == ATOM_STYLE ? DeclKind::STYLE : DeclKind::LAYOUT;
+      if (kind == ATOM_STYLE && p.tok.kind == Tok::IDENT)
+        out.add_variable(p.tok.atom, {Value::STYLE, i32(n_styles)});
+      if (kind == ATOM_STYLE)
+        n_styles++;
+      else if (kind != ATOM_LAYOUT)
+        return false;
     } else {
-      error_message += "EXPECTED '%' or id\n"; // TODO: better error message
-      parsing_had_error = true;
-      consume_token();
+      return false;
     }
+    if (p.errors.had_error)
+      return false;
+  }
+
+  // chunks of about the same size in bytes
+  std::vector<DeclChunk> chunks(n_threads);
+  u64 chunk_size = src.size() / n_threads + 1;
+  for (u32 c = 0, i = 0; c < n_threads; c++) {
+    chunks[c].first = i;
+    while (i < spans.size() &&
+           (c + 1 == n_threads || spans[i].begin < (c + 1) * chunk_size))
+      i++;
+    chunks[c].last = i;
+    chunks[c].cv.symbols = SymbolTable(&out.symbols);
+    chunks[c].cv.variables = out.variables;
+    chunks[c].cv.variable_index = out.variable_index;
+  }
+
+  std::vector<std::thread> threads;
+  for (u32 c = 1; c < n_threads; c++)
+    threads.emplace_back(parse_chunk, std::ref(chunks[c]), src.data(),
+                         std::span(spans), std::cref(decls),
+                         std::cref(vars_before));
+  parse_chunk(chunks[0], src.data(), spans, decls, vars_before);
+  for (auto &t : threads)
+    t.join();
+
+  // link: the chunks in order, with their indices and atoms moved to `out`
+  u32 base_symbols = out.symbols.size();
+  for (auto &c : chunks) {
+    if (c.errors.had_error)
+      return false;
+    std::vector<Atom> new_atoms(c.cv.symbols.size() - base_symbols, NO_ATOM);
+    auto remap = [&](Atom a) {
+      if (a == NO_ATOM || a < base_symbols)
+        return a;
+      auto &g = new_atoms[a - base_symbols];
+      if (g == NO_ATOM)
+        g = out.symbols.intern(c.cv.symbols.name(a));
+      return g;
+    };
+    u32 node_base = out.nodes.size();
+    u32 value_base = out.prop_values.size();
+    u32 style_base = out.style.size();
+    u32 layout_base = out.layout.size();
+    for (auto n : c.cv.nodes) {
+      n.kind = remap(n.kind);
+      n.name = remap(n.name);
+      if (n.first_child != NO_NODE)
+        n.first_child += node_base;
+      if (n.next_sibling != NO_NODE)
+        n.next_sibling += node_base;
+      n.props_begin += value_base;
+      out.nodes.push_back(n);
+    }
+    out.prop_values.insert(out.prop_values.end(), c.cv.prop_values.begin(),
+                           c.cv.prop_values.end());
+    out.style.insert(out.style.end(), c.cv.style.begin(), c.cv.style.end());
+    for (auto l : c.cv.layout)
+      out.layout.push_back({remap(l.name), l.root + node_base});
+
+    u32 k = 0;
+    for (u32 i = c.first; i < c.last; i++) {
+      if (decls[i].kind == DeclKind::VAR || decls[i].kind == DeclKind::OTHER)
+        continue;
+      auto &d = decls[i] = std::move(c.decls[k++]);
+      d.name = remap(d.name);
+      d.index += d.kind == DeclKind::STYLE ? style_base : layout_base;
+      d.vars_before = vars_before[i];
+      for (auto &a : d.deps)
+        a = remap(a);
+      for (auto &r : d.refs) {
+        r.value += value_base;
+        r.node += node_base;
+        r.var = remap(r.var);
+      }
+    }
+  }
+  out.decls = std::move(decls);
+  return true;
+}
+
+CV Parser::read_cv_source(char const *filename, SourceFile &&src) {
+  CV out;
+
+  l.open_source(filename, std::move(src));
+
+  u32 n_threads = threads ? threads : std::thread::hardware_concurrency();
+  if (n_threads > 1 && l.source.size >= PARALLEL_MIN_SIZE) {
+    if (parse_parallel(out, l.source.view(), n_threads))
+      return out;
+    out = CV();
   }
+
+  l.symbols = &out.symbols;
+  if (flat_tokens)
+    l.pretokenize();
+  parse_decls(*this, out);
+  return out;
+}
+
+CV Parser::read_cv_fd(char const *filename, int fd) {
+  CV out;
+  l.open_fd(filename, fd);
+  l.symbols = &out.symbols;
+  parse_decls(*this, out);
+  // the text is gone, a change can not be reparsed in place
+  out.decls.clear();
   return out;
 }
+
+// Puts back the result of reparsing `d`, which the parse functions appended
+// to the end of `cv`, at the place of its old result
+bool replace_decl(CV &cv, DeclInfo const &d, std::vector<bool> &changed) {
+  switch (d.kind) {
+  case DeclKind::VAR: {
+    auto val = cv.variables.back().val;
+    cv.variables.pop_back();
+    auto &var = cv.variables[d.index];
+    // only the first declaration of a name is ever read
+    if (cv.variable_index[d.name] == i32(d.index) &&
+        !same_value(var.val, val)) {
+      if (d.name >= changed.size())
+        changed.resize(d.name + 1);
+      changed[d.name] = true;
+    }
+    var.val = val;
+    return true;
+  }
+  case DeclKind::STYLE:
+    cv.style[d.index] = cv.style.back();
+    cv.style.pop_back();
+    // the variable still names the same index
+    if (d.name != NO_ATOM)
+      cv.variables.pop_back();
+    return true;
+  case DeclKind::LAYOUT:
+    cv.layout[d.index].root = cv.layout.back().root;
+    cv.layout.pop_back();
+    return true;
+  case DeclKind::OTHER:
+    break;
+  }
+  return false;
+}
+
+bool Parser::reparse(CV &cv, SourceFile const &src, CVChanges &changes) {
+  auto spans = split_decls(src.view());
+  if (cv.decls.empty() || spans.size() != cv.decls.size())
+    return false;
+
+  // variables whose value is not the same as in the previous parse
+  std::vector<bool> changed(cv.symbols.size());
+  auto is_changed = [&](Atom a) { return a < changed.size() && changed[a]; };
+
+  u32 live_nodes = 0;
+  for (u32 i = 0; i < spans.size(); i++) {
+    auto &d = cv.decls[i];
+    auto span = spans[i];
+    auto hash = hash_bytes(src.data + span.begin, span.end - span.begin);
+    bool text_changed = hash != d.hash;
+    bool deps_changed = false;
+    for (auto a : d.deps)
+      deps_changed |= is_changed(a);
+
+    if (!text_changed && deps_changed && d.kind == DeclKind::LAYOUT) {
+      // same text, so the values can be patched where they were stored
+      for (auto const &r : d.refs) {
+        if (!is_changed(r.var) || cv.variable_index[r.var] < 0 ||
+            u32(cv.variable_index[r.var]) >= d.vars_before)
+          continue;
+        auto val = *cv.find_variable(r.var);
+        if (!prop_accepts(r.prop, val))
+          return false;
+        cv.prop_values[r.value] = val;
+        changes.nodes.push_back(r.node);
+      }
+      deps_changed = false;
+    }
+
+    if (text_changed || deps_changed) {
+      Parser p;
+      p.l.open_range(src.data, span.begin, span.end);
+      p.l.symbols = &cv.symbols;
+      p.visible_vars = d.vars_before;
+      p.tok = p.l.lex();
+      if (p.tok.kind != Tok::PERCENT && p.tok.kind != Tok::IDENT)
+        return false;
+      auto nd = parse_decl(p, cv);
+      errors.append(p.errors);
+      if (p.errors.had_error || p.tok.kind != Tok::END ||
+          nd.kind != d.kind || nd.name != d.name)
+        return false;
+      nd.index = d.index;
+      nd.vars_before = d.vars_before;
+      if (!replace_decl(cv, nd, changed))
+        return false;
+      if (nd.kind == DeclKind::STYLE)
+        changes.styles.push_back(nd.index);
+      if (nd.kind == DeclKind::LAYOUT)
+        changes.layouts.push_back(nd.index);
+      d = std::move(nd);
+    }
+    d.begin = span.begin;
+    d.end = span.end;
+    d.hash = hash;
+    live_nodes += d.node_count;
+  }
+
+  // the nodes of replaced layouts are left behind, parse everything again
+  // once they are most of the arena
+  return cv.nodes.size() <= 2 * live_nodes + 4096;
+}
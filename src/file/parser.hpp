@@ -7,14 +7,34 @@
 
 struct Parser {
   Lexer l;
+  ErrorSink errors;
   Token tok;
   Loc prev_tok_location;
+  // tokenize the whole file before parsing, makes lookahead and
+  // backtracking O(1) cursor moves (see bench/lexer_bench.cpp)
+  bool flat_tokens = false;
+  // threads parsing the declarations of sources over PARALLEL_MIN_SIZE,
+  // 0 for one per core and 1 to always parse sequentially
+  u32 threads = 0;
+  static constexpr u64 PARALLEL_MIN_SIZE = 256 * 1024;
+  // declaration being parsed, collects its dependencies
+  DeclInfo *decl = nullptr;
+  // only variables declared before this index are visible
+  u32 visible_vars = u32(-1);
+
+  Parser() { l.errors = &errors; }
+  Parser(Parser const &) = delete;
+  Parser &operator=(Parser const &) = delete;
+
   void unconsume_token(Token const &t);
+  // backtracking, only with flat_tokens
+  u32 save_point() const { return l.cursor; }
+  void backtrack(u32 save_point);
   Loc consume_token();
   bool try_consume_token(Tok expected, Loc *loc_ptr = nullptr);
   bool expect_and_consume(Tok expected,
                           std::string_view message = "expected %s");
-  Token const &next_token() { return l.look_ahead(1); }
+  Token next_token() { return l.look_ahead(1); }
   void skip_until(std::span<Tok> end_toks);
   void skip_until(Tok t1) { skip_until(std::span<Tok>(&t1, 1)); }
   void skip_until(Tok t1, Tok t2) {
@@ -26,6 +46,15 @@ struct Parser {
     skip_until(ts);
   }
   CV read_cv_file(char const *filename);
+  CV read_cv_source(char const *filename, SourceFile &&src);
+  // parses while reading `fd` (a pipe, a socket...), with memory bounded
+  // by the lexer's window and the document, see Lexer::open_fd
+  CV read_cv_fd(char const *filename, int fd);
+  // Updates `cv`, parsed from a previous version of `src`, by reparsing only
+  // the top-level declarations whose text or variables changed, and adds
+  // what it changed to `changes`. Returns false if the whole file has to be
+  // parsed again instead.
+  bool reparse(CV &cv, SourceFile const &src, CVChanges &changes);
 };
 
 #endif // !PARSER_HPP
@@ -0,0 +1,142 @@
+#ifndef PROPS_HPP
+#define PROPS_HPP
+
+#include "../defines.hpp"
+#include "symbols.hpp"
+#include "value.hpp"
+#include <cmath>
+
+// Value kinds a property accepts, as a mask of 1 << Value::Kind
+enum PropKinds : u8 {
+  KINDS_LENGTH = (1 << Value::PC) | (1 << Value::VW) | (1 << Value::VH) |
+                 (1 << Value::NO_UNIT),
+  KINDS_SIZE = KINDS_LENGTH | (1 << Value::FIT),
+  KINDS_PERCENT = 1 << Value::PC,
+  KINDS_STYLE = 1 << Value::STYLE,
+  KINDS_COLOR = 1 << Value::COLOR,
+};
+
+// Every property an element or a style block can set: name (the atom is
+// ATOM_<name>), accepted kinds and default value. Inset groups must stay in
+// the order base, _x, _y, _t, _b, _l, _r.
+#define PROPERTIES(X)                                                          \
+  X(STYLE, KINDS_STYLE, Value(Value::STYLE, i32(-1)))                          \
+  X(W, KINDS_SIZE, Value(INFINITY))                                            \
+  X(H, KINDS_SIZE, Value(INFINITY))                                            \
+  X(GAP, KINDS_LENGTH, Value(0.f))                                             \
+  X(LOC, KINDS_PERCENT, Value(Value::PC, 50.f))                                \
+  X(BACKGROUND_COLOR, KINDS_COLOR, Value(Value::COLOR, i32(0)))                \
+  X(CORNER_RADIUS, KINDS_LENGTH, Value(0.f))                                   \
+  X(PADDING, KINDS_LENGTH, Value(0.f))                                         \
+  X(PADDING_X, KINDS_LENGTH, Value(0.f))                                       \
+  X(PADDING_Y, KINDS_LENGTH, Value(0.f))                                       \
+  X(PADDING_T, KINDS_LENGTH, Value(0.f))                                       \
+  X(PADDING_B, KINDS_LENGTH, Value(0.f))                                       \
+  X(PADDING_L, KINDS_LENGTH, Value(0.f))                                       \
+  X(PADDING_R, KINDS_LENGTH, Value(0.f))                                       \
+  X(MARGIN, KINDS_LENGTH, Value(0.f))                                          \
+  X(MARGIN_X, KINDS_LENGTH, Value(0.f))                                        \
+  X(MARGIN_Y, KINDS_LENGTH, Value(0.f))                                        \
+  X(MARGIN_T, KINDS_LENGTH, Value(0.f))                                        \
+  X(MARGIN_B, KINDS_LENGTH, Value(0.f))                                        \
+  X(MARGIN_L, KINDS_LENGTH, Value(0.f))                                        \
+  X(MARGIN_R, KINDS_LENGTH, Value(0.f))
+
+enum PropId : u8 {
+#define X(id, kinds, def) PROP_##id,
+  PROPERTIES(X)
+#undef X
+      PROP_COUNT,
+  PROP_NONE = PROP_COUNT,
+};
+static_assert(PROP_COUNT <= 32, "PropBlock::present is a u32");
+
+// properties that an element takes from its parent when neither it nor its
+// styles set them
+inline constexpr u32 INHERITED_PROPS = 1u << PROP_CORNER_RADIUS;
+
+struct PropInfo {
+  Atom atom;
+  u8 kinds;
+  Value default_val;
+};
+
+inline constexpr PropInfo PROP_INFO[PROP_COUNT] = {
+#define X(id, kinds, def) {ATOM_##id, kinds, def},
+    PROPERTIES(X)
+#undef X
+};
+
+struct PropOfAtomTable {
+  PropId v[ATOM_BUILTIN_COUNT];
+  constexpr PropOfAtomTable() : v{} {
+    for (auto &p : v)
+      p = PROP_NONE;
+    for (u32 i = 0; i < PROP_COUNT; i++)
+      v[PROP_INFO[i].atom] = PropId(i);
+  }
+};
+
+inline constexpr PropOfAtomTable PROP_OF_ATOM{};
+
+// PROP_NONE if the atom is not a property name
+inline PropId prop_of_atom(Atom a) {
+  return a < ATOM_BUILTIN_COUNT ? PROP_OF_ATOM.v[a] : PROP_NONE;
+}
+
+inline bool prop_accepts(PropId p, Value v) {
+  return PROP_INFO[p].kinds & (1 << v.kind);
+}
+
+// Sparse properties: the values of the set slots, in slot order
+struct PropSlice {
+  u32 present = 0;
+  Value const *values = nullptr;
+
+  bool has(PropId p) const { return present & (1u << p); }
+  Value get(PropId p) const {
+    return has(p) ? values[index(p)] : PROP_INFO[p].default_val;
+  }
+  Value get(PropId p, Value default_val) const {
+    return has(p) ? values[index(p)] : default_val;
+  }
+  u32 index(PropId p) const {
+    return __builtin_popcount(present & ((1u << p) - 1));
+  }
+};
+
+// Fixed-slot property storage with a presence bitmask
+struct PropBlock {
+  u32 present = 0;
+  Value slots[PROP_COUNT] = {};
+
+  bool has(PropId p) const { return present & (1u << p); }
+  // the property's default if it is not set
+  Value get(PropId p) const {
+    return has(p) ? slots[p] : PROP_INFO[p].default_val;
+  }
+  Value get(PropId p, Value default_val) const {
+    return has(p) ? slots[p] : default_val;
+  }
+  void set(PropId p, Value v) {
+    slots[p] = v;
+    present |= 1u << p;
+  }
+  // properties set in `o` override ours
+  void merge(PropBlock const &o) {
+    for (u32 m = o.present; m; m &= m - 1) {
+      u32 p = __builtin_ctz(m);
+      slots[p] = o.slots[p];
+    }
+    present |= o.present;
+  }
+  void merge(PropSlice const &o) {
+    u32 i = 0;
+    for (u32 m = o.present; m; m &= m - 1) {
+      slots[__builtin_ctz(m)] = o.values[i++];
+    }
+    present |= o.present;
+  }
+};
+
+#endif // !PROPS_HPP
@@ -0,0 +1,185 @@
+#include "scan.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+template <u8 CLS>
+static char const *skip_scalar(char const *p, char const *end) {
+  while (p != end && has_class(*p, CLS))
+    p++;
+  return p;
+}
+
+static char const *find_newline_scalar(char const *p, char const *end) {
+  while (p != end && !has_class(*p, CC_NEWLINE))
+    p++;
+  return p;
+}
+
+#if SCAN_X86
+
+// The vector scanners classify a whole register at a time with range
+// compares (unsigned `c - lo <= hi - lo`), turn the result into a bitmask and
+// locate the first byte that ends the run with a count of trailing zeros.
+// The tail shorter than a register goes through the scalar table.
+
+#define SSE2_RANGE(v, lo, hi)                                                  \
+  _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(char(lo))),        \
+                              _mm_set1_epi8(char((hi) - (lo)))),               \
+                 _mm_sub_epi8(v, _mm_set1_epi8(char(lo))))
+#define SSE2_EQ(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(char(c)))
+#define SSE2_LOWER(v) _mm_or_si128(v, _mm_set1_epi8(0x20))
+
+#define AVX2_RANGE(v, lo, hi)                                                  \
+  _mm256_cmpeq_epi8(                                                           \
+      _mm256_min_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(char(lo))),          \
+                      _mm256_set1_epi8(char((hi) - (lo)))),                    \
+      _mm256_sub_epi8(v, _mm256_set1_epi8(char(lo))))
+#define AVX2_EQ(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(char(c)))
+#define AVX2_LOWER(v) _mm256_or_si256(v, _mm256_set1_epi8(0x20))
+
+#define SSE2_SPACE(v) _mm_or_si128(SSE2_EQ(v, ' '), SSE2_RANGE(v, '\t', '\r'))
+#define SSE2_DIGIT(v) SSE2_RANGE(v, '0', '9')
+#define SSE2_IDENT(v)                                                          \
+  _mm_or_si128(_mm_or_si128(SSE2_RANGE(SSE2_LOWER(v), 'a', 'z'),               \
+                            SSE2_DIGIT(v)),                                    \
+               SSE2_EQ(v, '_'))
+#define SSE2_HEX(v)                                                            \
+  _mm_or_si128(SSE2_RANGE(SSE2_LOWER(v), 'a', 'f'), SSE2_DIGIT(v))
+#define SSE2_NEWLINE(v) _mm_or_si128(SSE2_EQ(v, '\n'), SSE2_EQ(v, '\r'))
+
+#define AVX2_SPACE(v)                                                          \
+  _mm256_or_si256(AVX2_EQ(v, ' '), AVX2_RANGE(v, '\t', '\r'))
+#define AVX2_DIGIT(v) AVX2_RANGE(v, '0', '9')
+#define AVX2_IDENT(v)                                                          \
+  _mm256_or_si256(_mm256_or_si256(AVX2_RANGE(AVX2_LOWER(v), 'a', 'z'),         \
+                                  AVX2_DIGIT(v)),                              \
+                  AVX2_EQ(v, '_'))
+#define AVX2_HEX(v)                                                            \
+  _mm256_or_si256(AVX2_RANGE(AVX2_LOWER(v), 'a', 'f'), AVX2_DIGIT(v))
+#define AVX2_NEWLINE(v) _mm256_or_si256(AVX2_EQ(v, '\n'), AVX2_EQ(v, '\r'))
+
+// Most runs (a space between two tokens, a short name) end within a few
+// bytes, where a vector load costs more than it saves: check those first.
+#define SHORT_RUN(CLS)                                                         \
+  for (u32 i = 0; i < 8; i++, p++) {                                           \
+    if (p == end || !has_class(*p, CLS))                                       \
+      return p;                                                                \
+  }
+
+#define SSE2_SKIP(fn, CLASS, CLS)                                              \
+  __attribute__((target("sse2"))) static char const *fn(char const *p,         \
+                                                        char const *end) {     \
+    SHORT_RUN(CLS)                                                             \
+    while (end - p >= 16) {                                                    \
+      __m128i v = _mm_loadu_si128((__m128i const *)p);                         \
+      u32 stop = ~u32(_mm_movemask_epi8(CLASS(v))) & 0xffff;                   \
+      if (stop)                                                                \
+        return p + __builtin_ctz(stop);                                        \
+      p += 16;                                                                 \
+    }                                                                          \
+    return skip_scalar<CLS>(p, end);                                           \
+  }
+
+#define AVX2_SKIP(fn, CLASS, CLS)                                              \
+  __attribute__((target("avx2"))) static char const *fn(char const *p,         \
+                                                        char const *end) {     \
+    SHORT_RUN(CLS)                                                             \
+    while (end - p >= 32) {                                                    \
+      __m256i v = _mm256_loadu_si256((__m256i const *)p);                      \
+      u32 stop = ~u32(_mm256_movemask_epi8(CLASS(v)));                         \
+      if (stop)                                                                \
+        return p + __builtin_ctz(stop);                                        \
+      p += 32;                                                                 \
+    }                                                                          \
+    return skip_scalar<CLS>(p, end);                                           \
+  }
+
+SSE2_SKIP(skip_space_sse2, SSE2_SPACE, CC_SPACE)
+SSE2_SKIP(skip_ident_sse2, SSE2_IDENT, CC_IDENT)
+SSE2_SKIP(skip_digits_sse2, SSE2_DIGIT, CC_DIGIT)
+SSE2_SKIP(skip_hex_sse2, SSE2_HEX, CC_HEX)
+
+AVX2_SKIP(skip_space_avx2, AVX2_SPACE, CC_SPACE)
+AVX2_SKIP(skip_ident_avx2, AVX2_IDENT, CC_IDENT)
+AVX2_SKIP(skip_digits_avx2, AVX2_DIGIT, CC_DIGIT)
+AVX2_SKIP(skip_hex_avx2, AVX2_HEX, CC_HEX)
+
+__attribute__((target("sse2"))) static char const *
+find_newline_sse2(char const *p, char const *end) {
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((__m128i const *)p);
+    u32 found = _mm_movemask_epi8(SSE2_NEWLINE(v));
+    if (found)
+      return p + __builtin_ctz(found);
+    p += 16;
+  }
+  return find_newline_scalar(p, end);
+}
+
+__attribute__((target("avx2"))) static char const *
+find_newline_avx2(char const *p, char const *end) {
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((__m256i const *)p);
+    u32 found = _mm256_movemask_epi8(AVX2_NEWLINE(v));
+    if (found)
+      return p + __builtin_ctz(found);
+    p += 32;
+  }
+  return find_newline_scalar(p, end);
+}
+
+#endif
+
+static Scanner const SCANNERS[] = {
+    {"scalar", skip_scalar<CC_SPACE>, skip_scalar<CC_IDENT>,
+     skip_scalar<CC_DIGIT>, skip_scalar<CC_HEX>, find_newline_scalar},
+#if SCAN_X86
+    {"sse2", skip_space_sse2, skip_ident_sse2, skip_digits_sse2, skip_hex_sse2,
+     find_newline_sse2},
+    {"avx2", skip_space_avx2, skip_ident_avx2, skip_digits_avx2, skip_hex_avx2,
+     find_newline_avx2},
+#endif
+};
+
+static bool cpu_supports(char const *name) {
+#if SCAN_X86
+  // `scanner` is selected by a static initializer, which may run before the
+  // one of libgcc that fills what __builtin_cpu_supports reads
+  __builtin_cpu_init();
+  if (std::strcmp(name, "sse2") == 0)
+    return __builtin_cpu_supports("sse2");
+  if (std::strcmp(name, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return std::strcmp(name, "scalar") == 0;
+}
+
+bool use_scanner(char const *name) {
+  if (!cpu_supports(name))
+    return false;
+  for (auto const &s : SCANNERS) {
+    if (std::strcmp(s.name, name) == 0) {
+      scanner = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+static Scanner select_scanner() {
+  Scanner best = SCANNERS[0];
+  for (auto const &s : SCANNERS) {
+    if (cpu_supports(s.name))
+      best = s;
+  }
+  return best;
+}
+
+Scanner scanner = select_scanner();
@@ -0,0 +1,67 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include "../defines.hpp"
+
+// Character classes used by the lexer. Unlike <cctype> these do not depend
+// on the locale.
+enum CharClass : u8 {
+  CC_SPACE = 1 << 0,
+  CC_IDENT_START = 1 << 1,
+  CC_IDENT = 1 << 2,
+  CC_DIGIT = 1 << 3,
+  CC_HEX = 1 << 4,
+  CC_NEWLINE = 1 << 5,
+  // bytes that matter when splitting declarations, see split_decls
+  CC_DECL = 1 << 6,
+};
+
+struct CharClassTable {
+  u8 v[256];
+  constexpr CharClassTable() : v{} {
+    for (u32 c = 0; c < 256; c++) {
+      bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+      bool digit = c >= '0' && c <= '9';
+      if (c == ' ' || (c >= '\t' && c <= '\r'))
+        v[c] |= CC_SPACE;
+      if (alpha || c == '_')
+        v[c] |= CC_IDENT_START;
+      if (alpha || digit || c == '_')
+        v[c] |= CC_IDENT;
+      if (digit)
+        v[c] |= CC_DIGIT;
+      if (digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+        v[c] |= CC_HEX;
+      if (c == '\n' || c == '\r')
+        v[c] |= CC_NEWLINE;
+      if (c == ';' || c == '%' || c == '{' || c == '}' || c == '(' ||
+          c == ')')
+        v[c] |= CC_DECL;
+    }
+  }
+};
+
+inline constexpr CharClassTable char_class{};
+
+inline bool has_class(char c, u8 cls) { return char_class.v[u8(c)] & cls; }
+
+// Byte scanners used to find token boundaries. The skip_* functions return
+// the first position in [p, end) that is not in the class, find_newline the
+// first '\n' or '\r'. All of them return `end` if there is none.
+struct Scanner {
+  char const *name;
+  char const *(*skip_space)(char const *p, char const *end);
+  char const *(*skip_ident)(char const *p, char const *end);
+  char const *(*skip_digits)(char const *p, char const *end);
+  char const *(*skip_hex)(char const *p, char const *end);
+  char const *(*find_newline)(char const *p, char const *end);
+};
+
+// widest implementation supported by the cpu, picked at startup
+extern Scanner scanner;
+
+// force an implementation ("scalar", "sse2" or "avx2"), returns false if it
+// is not available on this cpu
+bool use_scanner(char const *name);
+
+#endif // !SCAN_HPP
@@ -0,0 +1,87 @@
+#include "source.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceFile::SourceFile(SourceFile &&o) { *this = std::move(o); }
+
+SourceFile &SourceFile::operator=(SourceFile &&o) {
+  if (this == &o)
+    return *this;
+  close();
+  mapped = o.mapped;
+  size = o.size;
+  if (mapped) {
+    data = o.data;
+  } else {
+    // moving a short string moves its bytes, so re-point at our copy
+    owned = std::move(o.owned);
+    data = owned.data();
+  }
+  o.mapped = false;
+  o.data = nullptr;
+  o.size = 0;
+  return *this;
+}
+
+SourceFile::~SourceFile() { close(); }
+
+void SourceFile::close() {
+  if (mapped)
+    munmap(const_cast<char *>(data), size);
+  mapped = false;
+  data = nullptr;
+  size = 0;
+  owned.clear();
+}
+
+void SourceFile::assign(std::string &&contents) {
+  close();
+  owned = std::move(contents);
+  data = owned.data();
+  size = owned.size();
+}
+
+static bool read_fd(SourceFile &f, int fd) {
+  char buf[65536];
+  while (true) {
+    auto n = read(fd, buf, sizeof(buf));
+    if (n < 0)
+      return false;
+    if (n == 0)
+      break;
+    f.owned.append(buf, n);
+  }
+  f.data = f.owned.data();
+  f.size = f.owned.size();
+  return true;
+}
+
+bool SourceFile::open(char const *filename) {
+  close();
+  if (std::strcmp(filename, "-") == 0)
+    return read_fd(*this, STDIN_FILENO);
+
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  bool ok = false;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      data = static_cast<char const *>(p);
+      size = st.st_size;
+      mapped = true;
+      ok = true;
+    }
+  }
+  if (!ok)
+    ok = read_fd(*this, fd);
+  ::close(fd);
+  return ok;
+}
@@ -0,0 +1,32 @@
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include "../defines.hpp"
+#include <string>
+#include <string_view>
+
+// Read-only contents of a source file. Regular files are memory mapped so
+// tokens can point straight into the mapping; pipes and stdin ("-") fall
+// back to an owned buffer. The contents are not NUL terminated, the lexer
+// scans up to `size`.
+struct SourceFile {
+  char const *data = nullptr;
+  u64 size = 0;
+  bool mapped = false;
+  std::string owned;
+
+  SourceFile() = default;
+  SourceFile(SourceFile const &) = delete;
+  SourceFile &operator=(SourceFile const &) = delete;
+  SourceFile(SourceFile &&);
+  SourceFile &operator=(SourceFile &&);
+  ~SourceFile();
+
+  bool open(char const *filename);
+  // takes ownership of an in-memory source
+  void assign(std::string &&contents);
+  void close();
+  std::string_view view() const { return {data, size}; }
+};
+
+#endif // !SOURCE_HPP
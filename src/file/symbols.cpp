@@ -0,0 +1,43 @@
+#include "symbols.hpp"
+#include "hash.hpp"
+
+u64 SymbolTable::Hash::operator()(std::string_view s) const {
+  return hash_bytes(s);
+}
+
+SymbolTable::SymbolTable() {
+  static constexpr char const *BUILTINS[] = {
+#define X(id, str) str,
+      BUILTIN_SYMBOLS(X)
+#undef X
+  };
+  names.reserve(ATOM_BUILTIN_COUNT);
+  for (auto name : BUILTINS)
+    intern(name);
+}
+
+SymbolTable::SymbolTable(SymbolTable const *parent)
+    : parent(parent), first(parent->size()) {}
+
+Atom SymbolTable::intern(std::string_view name) {
+  if (parent) {
+    if (Atom a = parent->find(name); a != NO_ATOM)
+      return a;
+  }
+  if (auto it = atoms.find(name); it != atoms.end())
+    return it->second;
+  Atom a = size();
+  names.emplace_back(name);
+  atoms.emplace(names.back(), a);
+  return a;
+}
+
+Atom SymbolTable::find(std::string_view name) const {
+  if (parent) {
+    if (Atom a = parent->find(name); a != NO_ATOM)
+      return a;
+  }
+  if (auto it = atoms.find(name); it != atoms.end())
+    return it->second;
+  return NO_ATOM;
+}
@@ -0,0 +1,90 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include "../defines.hpp"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Identifiers are interned once per document and referred to by their atom
+// afterwards, so comparing or looking up names is an integer operation.
+using Atom = u32;
+inline constexpr Atom NO_ATOM = Atom(-1);
+
+// Identifiers the program knows about. They are interned first, in this
+// order, so their atoms are compile-time constants. Each inset group
+// (padding, margin) must stay in the order base, _x, _y, _t, _b, _l, _r.
+#define BUILTIN_SYMBOLS(X)                                                     \
+  X(ROOT, "%root%")                                                            \
+  X(STYLE, "style")                                                            \
+  X(LAYOUT, "layout")                                                          \
+  X(FORMAT, "format")                                                          \
+  X(VW, "vw")                                                                  \
+  X(VH, "vh")                                                                  \
+  X(LAYERS, "layers")                                                          \
+  X(BOX, "box")                                                                \
+  X(COLUMN, "column")                                                          \
+  X(ROW, "row")                                                                \
+  X(HSPLIT, "hsplit")                                                          \
+  X(VSPLIT, "vsplit")                                                          \
+  X(W, "w")                                                                    \
+  X(H, "h")                                                                    \
+  X(GAP, "gap")                                                                \
+  X(LOC, "loc")                                                                \
+  X(BACKGROUND_COLOR, "background_color")                                      \
+  X(CORNER_RADIUS, "corner_radius")                                            \
+  X(PADDING, "padding")                                                        \
+  X(PADDING_X, "padding_x")                                                    \
+  X(PADDING_Y, "padding_y")                                                    \
+  X(PADDING_T, "padding_t")                                                    \
+  X(PADDING_B, "padding_b")                                                    \
+  X(PADDING_L, "padding_l")                                                    \
+  X(PADDING_R, "padding_r")                                                    \
+  X(MARGIN, "margin")                                                          \
+  X(MARGIN_X, "margin_x")                                                      \
+  X(MARGIN_Y, "margin_y")                                                      \
+  X(MARGIN_T, "margin_t")                                                      \
+  X(MARGIN_B, "margin_b")                                                      \
+  X(MARGIN_L, "margin_l")                                                      \
+  X(MARGIN_R, "margin_r")                                                      \
+  X(FIT, "fit")                                                                \
+  X(A3, "A3")                                                                  \
+  X(A4, "A4")                                                                  \
+  X(A5, "A5")                                                                  \
+  X(LETTER, "letter")                                                          \
+  X(PORTRAIT, "portrait")                                                      \
+  X(LANDSCAPE, "landscape")
+
+enum BuiltinAtom : Atom {
+#define X(id, str) ATOM_##id,
+  BUILTIN_SYMBOLS(X)
+#undef X
+      ATOM_BUILTIN_COUNT
+};
+
+struct SymbolTable {
+  struct Hash {
+    using is_transparent = void;
+    u64 operator()(std::string_view s) const;
+  };
+  std::vector<std::string> names;
+  std::unordered_map<std::string, Atom, Hash, std::equal_to<>> atoms;
+  // a table with a parent only stores the names the parent does not have,
+  // with atoms following the parent's. The parent is only read, so several
+  // threads can intern into their own tables over the same parent.
+  SymbolTable const *parent = nullptr;
+  u32 first = 0;
+
+  SymbolTable();
+  explicit SymbolTable(SymbolTable const *parent);
+  Atom intern(std::string_view name);
+  // NO_ATOM if the name was never interned
+  Atom find(std::string_view name) const;
+  std::string const &name(Atom a) const {
+    return a < first ? parent->name(a) : names[a - first];
+  }
+  u32 size() const { return first + names.size(); }
+};
+
+#endif // !SYMBOLS_HPP
@@ -0,0 +1,32 @@
+#ifndef VALUE_HPP
+#define VALUE_HPP
+
+#include "../defines.hpp"
+
+struct Value { // TODO:
+  enum Kind {
+    PC,
+    VW,
+    VH,
+    NO_UNIT,
+    STYLE,
+    COLOR,
+    FIT, // sized to the content
+  } kind;
+  union {
+    f32 val;
+    i32 val_int;
+  };
+  Value() = default;
+  constexpr Value(Kind k, f32 val) : kind(k), val(val) {}
+  constexpr Value(Kind k, i32 val) : kind(k), val_int(val) {}
+  constexpr Value(f32 val) : kind(NO_UNIT), val(val) {}
+  Value &resolve_units(f32 vw, f32 vh);
+  f32 get_f32(f32 pc_mult) const;
+};
+
+inline bool same_value(Value a, Value b) {
+  return a.kind == b.kind && a.val_int == b.val_int;
+}
+
+#endif // !VALUE_HPP
@@ -1,13 +1,14 @@
-#include "file/filedata.hpp"
-#include "file/parser.hpp"
+#include "pipeline.hpp"
 #include "render/baseshader.hpp"
+#include "render/boxshader.hpp"
 #include "render/renderbatch.hpp"
-#include "render/renderbox.hpp"
-#include "render/renderlist.hpp"
 #include <SDL3/SDL_events.h>
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL_video.h>
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 
 #include <GL/glew.h>
 #include <SDL3/SDL.h>
@@ -21,46 +22,61 @@ u32 window_width, window_height;
 
 static constexpr u32 START_WINDOW_WIDTH = 1240;
 static constexpr u32 START_WINDOW_HEIGHT = 1754;
+// pixels per step of the mouse wheel
+static constexpr f32 SCROLL_STEP = 80.f;
 
-void batch_from_file(RenderBatch &batch, char const *filename) {
-  batch.vertices.clear();
-  batch.indices.clear();
-
-  Parser p;
-
-  parsing_had_error = false;
-  error_message.clear();
-
-  CV cv = p.read_cv_file(filename);
-
-  if (parsing_had_error)
-    cv = get_error_document();
-
-  cv.width = window_width;
-  cv.height = window_height;
-
-  auto root_renderbox = RenderBox(cv.layout[0].root, cv);
-
-  RenderList list;
-
-  root_renderbox.render(0, 0, window_width, window_height, list);
+// keeps `scroll` inside the strip of pages
+f32 clamp_scroll(Pipeline const &pipeline, f32 scroll) {
+  f32 end = pipeline.pages.strip_height() - f32(window_height);
+  return std::max(0.f, std::min(scroll, end));
+}
 
-  for (auto const &c : list) {
-    batch.rect(c);
+// the pages in the window, centered, from `scroll` down the strip
+void draw_pages(Pipeline &pipeline, f32 scroll) {
+  auto &pages = pipeline.pages;
+  u32 first, end;
+  pages.visible(scroll, window_height, first, end);
+  f32 x = std::max(0.f, (f32(window_width) - pages.width) / 2.f);
+  for (u32 k = first; k < end; k++) {
+    auto &batch = pipeline.page(k);
+    glUniform2f(1, x, pages.top(k) - scroll);
+    batch.render();
   }
-  batch.end();
 }
 
 void loop(SDL_Window *w, char const *filename) {
   BaseShader shader;
+  BoxShader box_shader;
   RenderBatch batch;
+  Pipeline pipeline;
+  pipeline.filename = filename;
+  if (char const *dir = getenv("CVTXT_CACHE_DIR"))
+    pipeline.cache_dir = dir;
+  // boxes drawn from one instance each instead of triangles
+  if (getenv("CVTXT_INSTANCED")) {
+    batch.instanced = true;
+    pipeline.pages.instanced = true;
+  }
+  // 16-bit positions in the vertices of the triangles
+  if (getenv("CVTXT_COMPACT")) {
+    batch.compact = true;
+    pipeline.pages.compact = true;
+  }
+  batch.mapped = true;
+  pipeline.pages.mapped = true;
 
-  batch_from_file(batch, filename);
+  pipeline.set_viewport(window_width, window_height);
+  pipeline.update(batch);
 
-  shader.use();
+  if (batch.instanced)
+    box_shader.use();
+  else
+    shader.use();
   glUniform2f(0, window_width, window_height);
 
-  batch.use();
+  f32 scroll = 0.f;
+  // only when something changed on screen
+  bool redraw = true;
 
   bool is_running = true;
   while (is_running) {
@@ -75,27 +91,52 @@ void loop(SDL_Window *w, char const *filename) {
         window_height = e.window.data2;
         glViewport(0, 0, window_width, window_height);
         glUniform2f(0, window_width, window_height);
-        batch_from_file(batch, filename);
+        pipeline.set_viewport(window_width, window_height);
+        pipeline.update(batch);
+        scroll = clamp_scroll(pipeline, scroll);
+        redraw = true;
         goto draw;
+      case SDL_EVENT_WINDOW_EXPOSED:
+        redraw = true;
+        break;
       case SDL_EVENT_KEY_DOWN:
         if (e.key.scancode == SDL_SCANCODE_W) {
           SDL_SetWindowSize(w, START_WINDOW_WIDTH, START_WINDOW_HEIGHT);
         }
         break;
+      case SDL_EVENT_MOUSE_WHEEL:
+        if (pipeline.paged()) {
+          scroll = clamp_scroll(pipeline, scroll - e.wheel.y * SCROLL_STEP);
+          redraw = true;
+          goto draw;
+        }
+        break;
       }
     }
   draw:
-    glClearColor(1.f, 1.f, 1.f, 1.f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    batch.render();
-    SDL_GL_SwapWindow(w);
+    if (redraw && pipeline.paged()) {
+      glClearColor(.5f, .5f, .5f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT);
+      draw_pages(pipeline, scroll);
+      SDL_GL_SwapWindow(w);
+    } else if (redraw) {
+      glClearColor(1.f, 1.f, 1.f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT);
+      glUniform2f(1, 0.f, 0.f);
+      batch.render();
+      SDL_GL_SwapWindow(w);
+    }
+    redraw = false;
 
     {
       struct stat result;
       if (stat(filename, &result) == 0) {
         if (last_modified < result.st_mtime) {
           last_modified = result.st_mtime;
-          batch_from_file(batch, filename);
+          pipeline.reload();
+          // the pages are patched when drawn
+          redraw = pipeline.update(batch) || pipeline.paged();
+          scroll = clamp_scroll(pipeline, scroll);
         }
       }
     }
@@ -115,7 +156,7 @@ int main(int argc, char *argv[]) {
                        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 6);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 5);
 
   SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, true);
 
@@ -135,7 +176,7 @@ int main(int argc, char *argv[]) {
     struct stat result;
     if (stat(argv[1], &result) == 0) {
       last_modified = result.st_mtime;
-    } else {
+    } else if (std::strcmp(argv[1], "-") != 0) {
       return 1;
     }
   }
@@ -0,0 +1,81 @@
+#include "pages.hpp"
+#include <algorithm>
+#include <cmath>
+
+f32 Pages::strip_height() const {
+  return pages.empty() ? 0.f : top(size()) - GAP;
+}
+
+void Pages::visible(f32 y, f32 h, u32 &first, u32 &end) const {
+  // page k covers [k * step, (k + 1) * step - GAP)
+  f32 step = height + GAP;
+  first = u32(std::clamp(std::floor((y + GAP) / step), 0.f, f32(size())));
+  end = u32(std::clamp(std::ceil((y + h) / step), f32(first), f32(size())));
+}
+
+void Pages::set_document(CV &cv) {
+  width = cv.format.width;
+  height = cv.format.height;
+  cv.width = width;
+  cv.height = height;
+
+  // The trees only keep pointing to valid styles for one reset, the ones
+  // not updated since the last are dropped. The others are kept so that
+  // showing them again only lays out what changed.
+  for (auto &p : pages) {
+    if (p && p->stale) {
+      p.reset();
+    } else if (p) {
+      p->stale = true;
+      p->ready = false;
+    }
+  }
+  pages.resize(cv.layout.size());
+  styles.reset(cv);
+}
+
+Pages::Page &Pages::page(CV const &cv, u32 k) {
+  auto &p = pages[k];
+  if (!p) {
+    p = std::make_unique<Page>();
+    p->batch.instanced = instanced;
+    p->batch.compact = compact;
+    p->batch.mapped = mapped;
+  }
+  p->last_used = ++clock;
+  if (p->ready)
+    return *p;
+
+  Rect r = {0, 0, width, height};
+  p->tree.pool = pool;
+  p->tree.update(cv, cv.layout[k].root, styles);
+  p->tree.layout(r);
+
+  // the paper under the boxes, what overflows the page is not drawn
+  list.clear();
+  list.push_back({r.x, r.y, r.w, r.h, 0.f, Color(0xffffffff), 0});
+  p->tree.emit(list, r);
+
+  if (p->batch.patch(p->drawn, list, diff)) {
+    p->drawn = list;
+    p->changed = true;
+  }
+  p->ready = true;
+  p->stale = false;
+
+  // evict the least recently used beyond the limit, never `k`
+  u32 n = 0;
+  for (auto const &q : pages)
+    n += q != nullptr;
+  for (; n > MAX_READY; n--) {
+    u32 lru = k;
+    for (u32 i = 0; i < size(); i++) {
+      if (pages[i] && pages[i]->last_used < pages[lru]->last_used)
+        lru = i;
+    }
+    pages[lru].reset();
+  }
+  return *p;
+}
+
+void Pages::clear() { pages.clear(); }
@@ -0,0 +1,62 @@
+#ifndef PAGES_HPP
+#define PAGES_HPP
+
+#include "defines.hpp"
+#include "file/filedata.hpp"
+#include "render/renderbatch.hpp"
+#include "render/renderbox.hpp"
+#include "render/renderlist.hpp"
+#include <memory>
+#include <vector>
+
+// The pages of a document with a `%format`: every layout is a page of that
+// size, and they are shown one under the other. A page is only laid out and
+// tessellated when it is asked for, so opening a long document costs the
+// pages on screen, and only the MAX_READY last used ones are kept.
+struct Pages {
+  struct Page {
+    RenderTree tree;
+    RenderBatch batch;
+    // batch holds the page of the current document
+    bool ready = false;
+    // the batch changed since it was last uploaded
+    bool changed = false;
+    // the commands of the batch
+    RenderList drawn;
+    // the tree was not updated since the last set_document()
+    bool stale = false;
+    u64 last_used = 0;
+  };
+  static constexpr u32 MAX_READY = 8;
+  // between two pages
+  static constexpr f32 GAP = 24.f;
+
+  f32 width = 0.f, height = 0.f;
+  // of the batches of the pages, see RenderBatch
+  bool instanced = false, compact = false, mapped = false;
+  // given to the trees of the pages, see RenderTree::pool
+  TaskPool *pool = nullptr;
+  StyleCache styles;
+  // null for the ones never asked for or evicted
+  std::vector<std::unique_ptr<Page>> pages;
+  RenderList list;
+  // of the last page made ready against what its batch held
+  ListDiff diff;
+  u64 clock = 0;
+
+  u32 size() const { return pages.size(); }
+  // position of page `k` in the strip of all pages
+  f32 top(u32 k) const { return k * (height + GAP); }
+  f32 strip_height() const;
+  // the pages [first, end) that overlap [y, y + h) of the strip
+  void visible(f32 y, f32 h, u32 &first, u32 &end) const;
+
+  // takes the format and the layouts of `cv`, and sets its size to the page
+  // one; no page is ready after it
+  void set_document(CV &cv);
+  // page `k`, laid out and tessellated if it was not ready
+  Page &page(CV const &cv, u32 k);
+  void clear();
+};
+
+#endif // !PAGES_HPP
@@ -0,0 +1,173 @@
+#include "pipeline.hpp"
+#include "file/cache.hpp"
+#include "file/hash.hpp"
+#include "file/parser.hpp"
+#include "render/renderbatch.hpp"
+#include <algorithm>
+#include <unistd.h>
+
+void Pipeline::reload() {
+  if (filename == "-") {
+    // stdin is read once, while it is parsed
+    if (has_cv)
+      return;
+    Parser p;
+    cv = p.read_cv_fd("-", STDIN_FILENO);
+    set_document(p.errors);
+    return;
+  }
+
+  SourceFile src;
+  bool opened = src.open(filename.c_str());
+  auto hash = hash_bytes(src.view());
+  if (has_cv && opened && hash == source_hash)
+    return;
+
+  Parser p;
+
+  // most edits touch a few declarations, try to reparse only those
+  CVChanges reparsed;
+  bool parsed = opened && has_cv && p.reparse(cv, src, reparsed);
+  bool in_place = parsed;
+  if (!parsed) {
+    // a failed reparse leaves its errors and a half updated cv behind
+    p.errors.clear();
+  }
+
+  u64 key = cache_key(hash);
+  std::string cache_file;
+  if (opened && !cache_dir.empty())
+    cache_file = cache_path(cache_dir, key);
+  if (!parsed && !cache_file.empty())
+    parsed = read_cache(cv, key, cache_file.c_str());
+
+  if (!parsed) {
+    if (!opened) {
+      p.errors.report("could not open file '");
+      p.errors.message += filename;
+      p.errors.message += "'\n";
+    }
+
+    cv = p.read_cv_source(filename.c_str(), std::move(src));
+
+    if (!p.errors.had_error && !cache_file.empty() &&
+        write_cache(cv, key, cache_file.c_str()))
+      trim_cache(cache_dir, CACHE_ENTRIES);
+  }
+
+  source_hash = hash;
+  if (in_place && !paged()) {
+    changes.append(reparsed);
+    errors = std::move(p.errors);
+    layout_valid = false;
+    return;
+  }
+  set_document(p.errors);
+}
+
+void Pipeline::set_document(ErrorSink &parse_errors) {
+  if (!parse_errors.had_error && cv.layout.empty())
+    parse_errors.report("no layout in file\n");
+
+  if (parse_errors.had_error)
+    cv = get_error_document();
+
+  errors = std::move(parse_errors);
+  has_cv = true;
+  tree_valid = false;
+  layout_valid = false;
+
+  if (paged())
+    pages.set_document(cv);
+  else
+    pages.clear();
+}
+
+void Pipeline::set_viewport(f32 w, f32 h) {
+  if (w == viewport_w && h == viewport_h)
+    return;
+  viewport_w = w;
+  viewport_h = h;
+  resized = true;
+  layout_valid = false;
+}
+
+void Pipeline::set_threads(u32 n) {
+  if (n == threads)
+    return;
+  threads = n;
+  // the next layout starts the new one
+  tree.pool = pages.pool = nullptr;
+  pool.reset();
+}
+
+TaskPool *Pipeline::start_pool() {
+  if (!pool && cv.nodes.size() >= 2 * RenderTree::PARALLEL_MIN_BOXES) {
+    u32 n = threads ? threads : std::thread::hardware_concurrency();
+    if (n > 1)
+      pool = std::make_unique<TaskPool>(n);
+  }
+  return pool.get();
+}
+
+bool Pipeline::update(RenderBatch &batch) {
+  if (!has_cv)
+    reload();
+  if (paged())
+    return false;
+
+  cv.width = viewport_w;
+  cv.height = viewport_h;
+  // only a reset drops the styles of past viewports and edits
+  if (styles.records.size() > 4 * live_styles + 4096)
+    tree_valid = false;
+  if (tree_valid && !changes.empty()) {
+    // the layout shown parsed again has new nodes, it is matched as a whole
+    auto const &l = changes.layouts;
+    tree_valid = std::find(l.begin(), l.end(), 0) == l.end() &&
+                 tree.restyle(cv, changes, styles);
+  }
+  if (tree_valid && resized)
+    tree.resize(cv, styles);
+  if (!tree_valid) {
+    styles.reset(cv);
+    tree.update(cv, cv.layout[0].root, styles);
+    tree_valid = true;
+    live_styles = styles.records.size();
+  }
+  changes.clear();
+  resized = false;
+
+  if (!layout_valid) {
+    tree.pool = start_pool();
+    tree.layout({0, 0, viewport_w, viewport_h});
+
+    // what is out of the window is not drawn
+    list.clear();
+    tree.emit(list, {0, 0, viewport_w, viewport_h});
+
+    layout_valid = true;
+    batch_valid = false;
+  }
+
+  if (batch_valid)
+    return false;
+  batch_valid = true;
+
+  // only what changed since the list drawn is tessellated again
+  if (!batch.patch(drawn, list, diff))
+    return false;
+  drawn = list;
+  batch.end();
+  return true;
+}
+
+RenderBatch &Pipeline::page(u32 k) {
+  pages.pool = start_pool();
+  auto &p = pages.page(cv, k);
+  if (p.changed) {
+    p.batch.end();
+    p.changed = false;
+  }
+  return p.batch;
+}
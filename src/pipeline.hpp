@@ -0,0 +1,80 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "defines.hpp"
+#include "file/errors.hpp"
+#include "file/filedata.hpp"
+#include "pages.hpp"
+#include "render/renderbox.hpp"
+#include "render/renderlist.hpp"
+#include "render/taskpool.hpp"
+#include <memory>
+#include <string>
+
+struct RenderBatch;
+
+// Staged document pipeline:
+//   source -> CV -> RenderTree -> RenderList -> RenderBatch
+// Every stage keeps its output and is only recomputed when one of its real
+// inputs changes: the content hash of the source for parsing, the viewport
+// size for layout and tessellation. An edit reparsed in place only restyles
+// the boxes it touched, and a resize the ones with values in vw or vh. A
+// document with a `%format` goes to `pages` instead, which lays out each
+// page when it is asked for.
+struct Pipeline {
+  std::string filename;
+  // where parsed documents are cached (see file/cache.hpp), empty for none
+  std::string cache_dir;
+
+  u64 source_hash = 0;
+  bool has_cv = false;
+  CV cv;
+  // of the last reload
+  ErrorSink errors;
+
+  f32 viewport_w = 0.f, viewport_h = 0.f;
+  // the tree was built from `cv`, and only `changes` were made to it since
+  bool tree_valid = false;
+  CVChanges changes;
+  // since the last update, the values in vw and vh are resolved again
+  bool resized = false;
+  // styles resolved by the last update of the whole tree, the ones resolved
+  // since for edits and resizes pile up on them until the next one
+  u64 live_styles = 0;
+  bool layout_valid = false;
+  StyleCache styles;
+  RenderTree tree;
+  RenderList list;
+  // the commands the batch holds, and how the last list differed from them
+  RenderList drawn;
+  ListDiff diff;
+
+  bool batch_valid = false;
+
+  Pages pages;
+
+  // threads laying out large trees, 0 for as many as the cpu has and 1 for
+  // none; set_threads() changes it
+  u32 threads = 0;
+  // shared by `tree` and the pages, started with the first large document
+  std::unique_ptr<TaskPool> pool;
+
+  // re-read the source; reparses only when its content actually changed
+  void reload();
+  // after parsing, substitutes the error document if there were errors
+  void set_document(ErrorSink &parse_errors);
+  void set_viewport(f32 w, f32 h);
+  // runs the stale stages, returns true if the batch changed; nothing when
+  // paged
+  bool update(RenderBatch &batch);
+
+  void set_threads(u32 n);
+  // the pool, if the document is large enough to need one
+  TaskPool *start_pool();
+
+  bool paged() const { return cv.format.is_set(); }
+  // the batch of page `k`, uploaded
+  RenderBatch &page(u32 k);
+};
+
+#endif // !PIPELINE_HPP
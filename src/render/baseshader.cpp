@@ -17,21 +17,27 @@ BaseShader::~BaseShader() {
 }
 void BaseShader::use() { glUseProgram(program); }
 
-char const *VTX_SHADER_SOURCE = R"(#version 460
+char const *VTX_SHADER_SOURCE = R"(#version 450
 layout (location = 0) in vec2 in_position;
 layout (location = 1) in vec4 in_color;
 
 layout (location = 0) out vec4 frag_color;
 
 layout (location = 0) uniform vec2 screen_size;
+// where the batch is drawn, for pages
+layout (location = 1) uniform vec2 offset;
+// the origin of the positions of the chunk drawn, and their unit
+layout (location = 2) uniform vec2 origin;
+layout (location = 3) uniform float unit;
 
 void main() {
-  vec2 pos = (in_position / screen_size) * 2.0 - 1.0;
+  vec2 pos = in_position * unit + origin + offset;
+  pos = (pos / screen_size) * 2.0 - 1.0;
   gl_Position = vec4(pos.x, -pos.y, 0.0, 1.0);
   frag_color = in_color;
 }
 )";
-char const *FRG_SHADER_SOURCE = R"(#version 460
+char const *FRG_SHADER_SOURCE = R"(#version 450
 layout (location = 0) in vec4 frag_color;
 
 layout (location = 0) out vec4 out_color;
@@ -41,14 +47,14 @@ void main() {
 }
 )";
 
-BaseShader::BaseShader() {
+u32 link_program(char const *vtx_source, char const *frg_source) {
   auto vtx = glCreateShader(GL_VERTEX_SHADER);
   auto frg = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(vtx, 1, &VTX_SHADER_SOURCE, nullptr);
-  glShaderSource(frg, 1, &FRG_SHADER_SOURCE, nullptr);
+  glShaderSource(vtx, 1, &vtx_source, nullptr);
+  glShaderSource(frg, 1, &frg_source, nullptr);
   glCompileShader(vtx);
   glCompileShader(frg);
-  program = glCreateProgram();
+  u32 program = glCreateProgram();
   glAttachShader(program, vtx);
   glAttachShader(program, frg);
   glLinkProgram(program);
@@ -57,4 +63,9 @@ BaseShader::BaseShader() {
   glDetachShader(program, frg);
   glDeleteShader(vtx);
   glDeleteShader(frg);
+  return program;
+}
+
+BaseShader::BaseShader() {
+  program = link_program(VTX_SHADER_SOURCE, FRG_SHADER_SOURCE);
 }
@@ -3,6 +3,13 @@
 
 #include "../defines.hpp"
 
+// compiles and links the two stages, returns the program
+u32 link_program(char const *vtx_source, char const *frg_source);
+
+// Draws the triangles of a RenderBatch. Its uniforms, shared with
+// BoxShader, are the size of the screen at location 0 and an offset of the
+// batch at location 1. RenderBatch::render sets the ones of each chunk, the
+// origin of its positions at location 2 and their unit at location 3.
 struct BaseShader {
   u32 program;
   BaseShader(BaseShader const &) = delete;
@@ -0,0 +1,76 @@
+#include "boxshader.hpp"
+#include "baseshader.hpp"
+
+#include <GL/glew.h>
+
+BoxShader::BoxShader(BoxShader &&o) {
+  program = o.program;
+  o.program = 0;
+}
+BoxShader &BoxShader::operator=(BoxShader &&o) {
+  program = o.program;
+  o.program = 0;
+  return *this;
+}
+BoxShader::~BoxShader() {
+  if (program)
+    glDeleteProgram(program);
+}
+void BoxShader::use() { glUseProgram(program); }
+
+// the instance is a RenderCmd, the vertex index picks the corner
+static char const *VTX_SHADER_SOURCE = R"(#version 450
+layout (location = 0) in vec4 in_rect;
+layout (location = 1) in float in_radius;
+layout (location = 2) in vec4 in_color;
+
+layout (location = 0) out vec4 frag_color;
+// from the center of the box
+layout (location = 1) out vec2 frag_pos;
+layout (location = 2) flat out vec2 half_size;
+layout (location = 3) flat out float radius;
+
+layout (location = 0) uniform vec2 screen_size;
+layout (location = 1) uniform vec2 offset;
+
+void main() {
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+  // boxes smaller than their margins have a negative size, they are drawn
+  // flipped as the triangles are
+  half_size = abs(in_rect.zw) * 0.5;
+  radius = clamp(in_radius, 0.0, min(half_size.x, half_size.y));
+  // a pixel out, for the smoothed edge
+  frag_pos = corner * (half_size + 1.0);
+  vec2 pos = in_rect.xy + in_rect.zw * 0.5 + frag_pos + offset;
+  pos = (pos / screen_size) * 2.0 - 1.0;
+  gl_Position = vec4(pos.x, -pos.y, 0.0, 1.0);
+  frag_color = in_color;
+}
+)";
+static char const *FRG_SHADER_SOURCE = R"(#version 450
+layout (location = 0) in vec4 frag_color;
+layout (location = 1) in vec2 frag_pos;
+layout (location = 2) flat in vec2 half_size;
+layout (location = 3) flat in float radius;
+
+layout (location = 0) out vec4 out_color;
+
+// signed distance to the rounded rectangle, negative inside
+float box_distance(vec2 p, vec2 b, float r) {
+  vec2 q = abs(p) - b + r;
+  return min(max(q.x, q.y), 0.0) + length(max(q, 0.0)) - r;
+}
+
+void main() {
+  float d = box_distance(frag_pos, half_size, radius);
+  // what the pixel around the fragment covers of the box
+  float coverage = clamp(0.5 - d, 0.0, 1.0);
+  if (coverage == 0.0)
+    discard;
+  out_color = vec4(frag_color.rgb, frag_color.a * coverage);
+}
+)";
+
+BoxShader::BoxShader() {
+  program = link_program(VTX_SHADER_SOURCE, FRG_SHADER_SOURCE);
+}
@@ -0,0 +1,20 @@
+#ifndef BOXSHADER_HPP
+#define BOXSHADER_HPP
+
+#include "../defines.hpp"
+
+// Draws the boxes of an instanced RenderBatch: each instance is a quad
+// around its box, and the fragments are covered by their distance to the
+// rounded rectangle, which smooths the edges.
+struct BoxShader {
+  u32 program;
+  BoxShader(BoxShader const &) = delete;
+  BoxShader &operator=(BoxShader const &) = delete;
+  BoxShader(BoxShader &&);
+  BoxShader &operator=(BoxShader &&);
+  BoxShader();
+  ~BoxShader();
+  void use();
+};
+
+#endif // !BOXSHADER_HPP
@@ -11,6 +11,7 @@ struct Color {
   Color(u32 i);
   Color(Value v);
   operator u32() const;
+  bool operator==(Color const &) const = default;
 };
 
 #endif // !COLOR_HPP
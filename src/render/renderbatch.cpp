@@ -1,146 +1,726 @@
 #include "renderbatch.hpp"
 
 #include <GL/glew.h>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <numbers>
 
-RenderBatch::RenderBatch() {
-  glCreateBuffers(1, &vbo);
-  glCreateBuffers(1, &ibo);
-  glCreateVertexArrays(1, &vao);
-  glVertexArrayVertexBuffer(vao, 0, vbo, 0, sizeof(Vertex));
-  glVertexArrayElementBuffer(vao, ibo);
-  glEnableVertexArrayAttrib(vao, 0);
-  glEnableVertexArrayAttrib(vao, 1);
-  glVertexArrayAttribBinding(vao, 0, 0);
-  glVertexArrayAttribBinding(vao, 1, 0);
-  glVertexArrayAttribFormat(vao, 0, 2, GL_FLOAT, false, 0);
-  glVertexArrayAttribFormat(vao, 1, 4, GL_UNSIGNED_BYTE, true, 2 * sizeof(f32));
-}
-RenderBatch::~RenderBatch() {
-  if (vao)
-    glDeleteVertexArrays(1, &vao);
-  if (vbo)
-    glDeleteBuffers(1, &vbo);
-  if (ibo)
-    glDeleteBuffers(1, &ibo);
-}
-RenderBatch::RenderBatch(RenderBatch &&o) {
-  vbo = o.vbo;
-  ibo = o.ibo;
-  vao = o.vao;
-  o.vao = o.ibo = o.vbo = 0;
+void MappedRing::next() {
+  region = (region + 1) % REGIONS;
+  used = 0;
+  wait();
+}
+
+void MappedRing::next_copy() {
+  u64 from = base(), n = used;
+  next();
+  if (n)
+    std::memcpy(data + base() * stride, data + from * stride, n * stride);
+  used = n;
+}
+
+void *MappedRing::append(u64 n, u32 elt_stride) {
+  assert(!stride || stride == elt_stride);
+  stride = elt_stride;
+  if (used + n > capacity) {
+    // A new buffer, with what the current region holds copied. The GPU
+    // keeps the old one alive for the draws still reading it.
+    u64 new_capacity = std::max({used + n, 2 * capacity, u64(1024)});
+    u64 bytes = REGIONS * new_capacity * stride;
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    u32 new_buffer;
+    glCreateBuffers(1, &new_buffer);
+    glNamedBufferStorage(new_buffer, bytes, nullptr, flags);
+    auto *new_data = (u8 *)glMapNamedBufferRange(new_buffer, 0, bytes, flags);
+    if (used)
+      std::memcpy(new_data + region * new_capacity * stride,
+                  data + base() * stride, used * stride);
+    u32 keep = region;
+    u64 keep_used = used;
+    release();
+    buffer = new_buffer;
+    data = new_data;
+    capacity = new_capacity;
+    region = keep;
+    used = keep_used;
+  }
+  void *out = data + (base() + used) * stride;
+  used += n;
+  return out;
+}
+
+void MappedRing::wait() {
+  if (!fences[region])
+    return;
+  auto sync = GLsync(fences[region]);
+  while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) ==
+         GL_TIMEOUT_EXPIRED)
+    ;
+  glDeleteSync(sync);
+  fences[region] = nullptr;
+}
+
+void MappedRing::fence() {
+  if (fences[region])
+    glDeleteSync(GLsync(fences[region]));
+  fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void MappedRing::release() {
+  for (auto &f : fences) {
+    if (f)
+      glDeleteSync(GLsync(f));
+    f = nullptr;
+  }
+  if (buffer) {
+    glUnmapNamedBuffer(buffer);
+    glDeleteBuffers(1, &buffer);
+  }
+  buffer = 0;
+  data = nullptr;
+  capacity = used = 0;
+  region = 0;
+}
+
+// the instances are the commands as they are, the id is not read
+static_assert(sizeof(RenderCmd) == 28);
+static_assert(sizeof(RenderBatch::CompactVertex) == 8);
+
+// how far from its origin a compact vertex can be
+static constexpr f32 COMPACT_RANGE = 32767.f / RenderBatch::SUBPIXELS;
+
+static void release_gl_objects(RenderBatch::Chunk &ch) {
+  if (ch.vao)
+    glDeleteVertexArrays(1, &ch.vao);
+  if (ch.vbo)
+    glDeleteBuffers(1, &ch.vbo);
+  if (ch.ibo)
+    glDeleteBuffers(1, &ch.ibo);
+  ch.vertex_ring.release();
+  ch.index_ring.release();
+}
+
+RenderBatch::Chunk::~Chunk() { release_gl_objects(*this); }
+RenderBatch::Chunk::Chunk(Chunk &&o) { *this = std::move(o); }
+RenderBatch::Chunk &RenderBatch::Chunk::operator=(Chunk &&o) {
+  release_gl_objects(*this);
+  first_cmd = o.first_cmd;
+  end_cmd = o.end_cmd;
+  compact = o.compact;
+  origin_x = o.origin_x;
+  origin_y = o.origin_y;
+  stride = o.stride;
   vertices = std::move(o.vertices);
   indices = std::move(o.indices);
-}
-RenderBatch &RenderBatch::operator=(RenderBatch &&o) {
+  cmd_vertex = std::move(o.cmd_vertex);
+  cmd_index = std::move(o.cmd_index);
+  vertex_ring = o.vertex_ring;
+  index_ring = o.index_ring;
+  o.vertex_ring = o.index_ring = {};
+  upload = o.upload;
+  dirty_vertices = std::move(o.dirty_vertices);
+  dirty_indices = std::move(o.dirty_indices);
   vbo = o.vbo;
   ibo = o.ibo;
   vao = o.vao;
   o.vao = o.ibo = o.vbo = 0;
-  vertices = std::move(o.vertices);
-  indices = std::move(o.indices);
   return *this;
 }
 
-void unstrip_indices(RenderBatch &b, std::vector<RenderBatch::Index> &&strip) {
-  if (strip.size() == 0)
-    return;
-  assert(strip.size() >= 3);
-  u32 last1 = strip[0];
-  u32 last2 = strip[1];
-  bool pair = true;
-  for (u64 i = 2; i < strip.size(); i++) {
-    u32 cur = strip[i];
-    b.indices.push_back(last1);
-    if (pair) {
-      b.indices.push_back(last2);
-      b.indices.push_back(cur);
-    } else {
-      b.indices.push_back(cur);
-      b.indices.push_back(last2);
+// the attributes of the vertices of `ch` and the buffers they come from
+static void set_format(RenderBatch const &b, RenderBatch::Chunk &ch) {
+  u32 vbo = b.mapped ? ch.vertex_ring.buffer : ch.vbo;
+  u32 ibo = b.mapped ? ch.index_ring.buffer : ch.ibo;
+  glVertexArrayVertexBuffer(ch.vao, 0, vbo, 0, ch.stride);
+  if (b.instanced) {
+    // one box per instance, see BoxShader
+    glVertexArrayBindingDivisor(ch.vao, 0, 1);
+    for (u32 k = 0; k < 3; k++) {
+      glEnableVertexArrayAttrib(ch.vao, k);
+      glVertexArrayAttribBinding(ch.vao, k, 0);
     }
-    last1 = last2;
-    last2 = cur;
-    pair = !pair;
-  }
-}
-
-void RenderBatch::rect(RenderCmd const &c) {
-  auto index0 = vertices.size();
-  if (c.r == 0) {
-    vertices.push_back({c.x, c.y, c.c});
-    vertices.push_back({c.x + c.w, c.y, c.c});
-    vertices.push_back({c.x + c.w, c.y + c.h, c.c});
-    vertices.push_back({c.x, c.y + c.h, c.c});
-    indices.push_back(index0 + 0);
-    indices.push_back(index0 + 1);
-    indices.push_back(index0 + 2);
-    indices.push_back(index0 + 0);
-    indices.push_back(index0 + 2);
-    indices.push_back(index0 + 3);
+    glVertexArrayAttribFormat(ch.vao, 0, 4, GL_FLOAT, false,
+                              offsetof(RenderCmd, x));
+    glVertexArrayAttribFormat(ch.vao, 1, 1, GL_FLOAT, false,
+                              offsetof(RenderCmd, r));
+    glVertexArrayAttribFormat(ch.vao, 2, 4, GL_UNSIGNED_BYTE, true,
+                              offsetof(RenderCmd, c));
     return;
   }
+  glVertexArrayElementBuffer(ch.vao, ibo);
+  for (u32 k = 0; k < 2; k++) {
+    glEnableVertexArrayAttrib(ch.vao, k);
+    glVertexArrayAttribBinding(ch.vao, k, 0);
+  }
+  // the shader scales the positions of compact chunks, see BaseShader
+  if (ch.compact) {
+    glVertexArrayAttribFormat(ch.vao, 0, 2, GL_SHORT, false,
+                              offsetof(RenderBatch::CompactVertex, x));
+    glVertexArrayAttribFormat(ch.vao, 1, 4, GL_UNSIGNED_BYTE, true,
+                              offsetof(RenderBatch::CompactVertex, c));
+  } else {
+    glVertexArrayAttribFormat(ch.vao, 0, 2, GL_FLOAT, false,
+                              offsetof(RenderBatch::Vertex, x));
+    glVertexArrayAttribFormat(ch.vao, 1, 4, GL_UNSIGNED_BYTE, true,
+                              offsetof(RenderBatch::Vertex, c));
+  }
+}
+
+// the GL objects are only created on the first upload, so batches can be
+// filled without a GL context (see bench/stage_bench.cpp)
+static void create_gl_objects(RenderBatch const &b, RenderBatch::Chunk &ch) {
+  // the rings have their own buffers
+  if (!b.mapped) {
+    glCreateBuffers(1, &ch.vbo);
+    glCreateBuffers(1, &ch.ibo);
+  }
+  glCreateVertexArrays(1, &ch.vao);
+}
+
+// so that a box always fits in a chunk, enough up to radii of thousands of
+// pixels
+static constexpr u32 MAX_CORNER_POINTS = 256;
+
+// Points on each rounded corner between its two straight edges, enough
+// for the curve to stay within about a third of a pixel of the circle.
+static u32 corner_points(f32 r) {
+  f64 n = std::numbers::pi / (4.0f * std::acos(1 - 0.33 / r));
+  // nan or negative for the radii too small to curve
+  return n > 0 ? u32(std::min(n, f64(MAX_CORNER_POINTS))) : 0;
+}
+
+// The box tessellated for `c`, as BoxShader draws it: a negative size is
+// flipped, and the radius is at most half of the smaller side.
+static RenderCmd normalized(RenderCmd c) {
+  if (c.w < 0) {
+    c.x += c.w;
+    c.w = -c.w;
+  }
+  if (c.h < 0) {
+    c.y += c.h;
+    c.h = -c.h;
+  }
+  c.r = c.r > 0 ? std::min(c.r, std::min(c.w, c.h) / 2) : 0.f;
+  return c;
+}
+
+// cos and sin of the angles of the `n` points of a corner, from one edge
+// to the other, computed once per count
+static f32 const *corner_table(u32 n) {
+  static thread_local std::vector<std::vector<f32>> tables;
+  if (n >= tables.size())
+    tables.resize(n + 1);
+  auto &t = tables[n];
+  if (t.empty() && n) {
+    t.resize(2 * n);
+    f64 incr = (std::numbers::pi / 2.0) / (n + 1.0);
+    for (u32 i = 0; i < n; i++) {
+      t[2 * i] = std::cos(incr * (1 + i));
+      t[2 * i + 1] = std::sin(incr * (1 + i));
+    }
+  }
+  return t.data();
+}
+
+static u32 vertex_count(u32 n) { return 8 + 4 * n; }
+// of the triangles of the strip written by write_rounded()
+static u32 index_count(u32 n) { return 3 * (6 + 4 * n); }
+
+// Writes the vertices of a chunk in its format, `v(i, x, y, c)` sets the
+// i-th from where it points, and `v + n` points n further.
+struct FloatVertices {
+  RenderBatch::Vertex *v;
+  void operator()(u32 i, f32 x, f32 y, Color c) const { v[i] = {x, y, c}; }
+  FloatVertices operator+(u32 n) const { return {v + n}; }
+};
+struct CompactVertices {
+  RenderBatch::CompactVertex *v;
+  f32 x0, y0;
+  // to the nearest, kept positive so that truncating rounds
+  static i16 fixed(f32 d) {
+    return i16(i32(d * RenderBatch::SUBPIXELS + 32768.5f) - 32768);
+  }
+  void operator()(u32 i, f32 x, f32 y, Color c) const {
+    v[i] = {fixed(x - x0), fixed(y - y0), c};
+  }
+  CompactVertices operator+(u32 n) const { return {v + n, x0, y0}; }
+};
+
+// calls `f` with the writer of the vertices of `ch` from `v`
+template <typename F>
+static void with_vertices(RenderBatch::Chunk const &ch, u8 *v, F &&f) {
+  if (ch.compact)
+    f(CompactVertices{(RenderBatch::CompactVertex *)v, ch.origin_x,
+                      ch.origin_y});
+  else
+    f(FloatVertices{(RenderBatch::Vertex *)v});
+}
+
+// Turns a triangle strip into a list of triangles as its points come, so
+// the strip is never stored. They come in pairs across the strip, each new
+// pair closes the two triangles of a quad with the previous one.
+struct StripWriter {
+  RenderBatch::Index *out;
+  RenderBatch::Index a = 0, b = 0;
+  bool first = true;
+
+  void operator()(RenderBatch::Index na, RenderBatch::Index nb) {
+    if (!first) {
+      // every other triangle of a strip is flipped back to its winding
+      out[0] = a;
+      out[1] = b;
+      out[2] = na;
+      out[3] = b;
+      out[4] = nb;
+      out[5] = na;
+      out += 6;
+    }
+    a = na;
+    b = nb;
+    first = false;
+  }
+};
+
+// Box `c` with corners of `n` points, to `v` and `idx`, which have room for
+// vertex_count(n) and index_count(n). Its vertices are numbered from `i0`.
+template <typename Out>
+static void write_rounded(RenderCmd const &c, u32 n, Out v,
+                          RenderBatch::Index *idx, u32 i0) {
   f32 x1 = c.x + c.r;
   f32 x2 = c.x + c.w - c.r;
   f32 y1 = c.y + c.r;
   f32 y2 = c.y + c.h - c.r;
-  int n_point_needed = std::numbers::pi / (4.0f * std::acos(1 - 0.33 / c.r));
-  vertices.push_back({c.x, y1, c.c});
-  vertices.push_back({c.x + c.w, y1, c.c});
-  vertices.push_back({c.x + c.w, y2, c.c});
-  vertices.push_back({c.x, y2, c.c});
-  auto index1 = vertices.size();
-  vertices.push_back({x1, c.y, c.c});
-  vertices.push_back({x2, c.y, c.c});
-  vertices.push_back({x2, c.y + c.h, c.c});
-  vertices.push_back({x1, c.y + c.h, c.c});
-  auto index2 = vertices.size();
-  vertices.resize(vertices.size() + 4 * n_point_needed);
-  auto index3 = index2 + n_point_needed;
-  auto index4 = index3 + n_point_needed;
-  auto index5 = index4 + n_point_needed;
-  f32 incr = (std::numbers::pi / 2.f) / (n_point_needed + 1.f);
-  auto pt_x = [&](f32 x, f32 a) { return x + std::cos(a) * c.r; };
-  auto pt_y = [&](f32 y, f32 a) { return y - std::sin(a) * c.r; };
-  for (int i = 0; i < n_point_needed; i++) {
-    f32 pos = incr * (1 + i);
-    f32 a_tl = std::numbers::pi - pos;
-    f32 a_bl = std::numbers::pi + pos;
-    f32 a_tr = std::numbers::pi / 2.f - pos;
-    f32 a_br = -std::numbers::pi / 2.f + pos;
-    vertices[index2 + i] = {pt_x(x1, a_tl), pt_y(y1, a_tl), c.c};
-    vertices[index3 + i] = {pt_x(x2, a_tr), pt_y(y1, a_tr), c.c};
-    vertices[index4 + i] = {pt_x(x2, a_br), pt_y(y2, a_br), c.c};
-    vertices[index5 + i] = {pt_x(x1, a_bl), pt_y(y2, a_bl), c.c};
-  }
-  std::vector<Index> strip;
-  strip.push_back(index0);
-  strip.push_back(index0 + 3);
-  for (int i = 0; i < n_point_needed; i++) {
-    strip.push_back(index2 + i);
-    strip.push_back(index5 + i);
-  }
-  strip.push_back(index1 + 0);
-  strip.push_back(index1 + 3);
-  strip.push_back(index1 + 1);
-  strip.push_back(index1 + 2);
-  for (int i = 0; i < n_point_needed; i++) {
-    strip.push_back(index3 + i);
-    strip.push_back(index4 + i);
-  }
-  strip.push_back(index0 + 1);
-  strip.push_back(index0 + 2);
-  unstrip_indices(*this, std::move(strip));
+  // the cross of the straight edges, then the four corners
+  v(0, c.x, y1, c.c);
+  v(1, c.x + c.w, y1, c.c);
+  v(2, c.x + c.w, y2, c.c);
+  v(3, c.x, y2, c.c);
+  v(4, x1, c.y, c.c);
+  v(5, x2, c.y, c.c);
+  v(6, x2, c.y + c.h, c.c);
+  v(7, x1, c.y + c.h, c.c);
+  auto tl = v + 8, tr = tl + n, br = tr + n, bl = br + n;
+  f32 const *t = corner_table(n);
+  for (u32 i = 0; i < n; i++) {
+    f32 dc = t[2 * i] * c.r, ds = t[2 * i + 1] * c.r;
+    tl(i, x1 - dc, y1 - ds, c.c);
+    tr(i, x2 + ds, y1 - dc, c.c);
+    br(i, x2 + ds, y2 + dc, c.c);
+    bl(i, x1 - dc, y2 + ds, c.c);
+  }
+
+  // one strip from the left edge to the right one
+  u32 i1 = i0 + 4, i2 = i0 + 8;
+  u32 i3 = i2 + n, i4 = i3 + n, i5 = i4 + n;
+  StripWriter strip{idx};
+  strip(i0, i0 + 3);
+  for (u32 i = 0; i < n; i++)
+    strip(i2 + i, i5 + i);
+  strip(i1 + 0, i1 + 3);
+  strip(i1 + 1, i1 + 2);
+  for (u32 i = 0; i < n; i++)
+    strip(i3 + i, i4 + i);
+  strip(i0 + 1, i0 + 2);
+  assert(strip.out == idx + index_count(n));
+}
+
+template <typename Out>
+static void write_plain(RenderCmd const &c, Out v, RenderBatch::Index *idx,
+                        u32 i0) {
+  v(0, c.x, c.y, c.c);
+  v(1, c.x + c.w, c.y, c.c);
+  v(2, c.x + c.w, c.y + c.h, c.c);
+  v(3, c.x, c.y + c.h, c.c);
+  u32 quad[] = {0, 1, 2, 0, 2, 3};
+  for (u32 k = 0; k < 6; k++)
+    idx[k] = i0 + quad[k];
+}
+
+// whether all of `c` is within the range of the origin of `ch`
+static bool in_range(RenderBatch::Chunk const &ch, RenderCmd const &c) {
+  f32 x = c.x - ch.origin_x, y = c.y - ch.origin_y;
+  // false for nan too
+  return std::min(x, x + c.w) >= -COMPACT_RANGE &&
+         std::max(x, x + c.w) <= COMPACT_RANGE &&
+         std::min(y, y + c.h) >= -COMPACT_RANGE &&
+         std::max(y, y + c.h) <= COMPACT_RANGE;
 }
+
+// empty again, in the next regions of its rings
+static void reset(RenderBatch const &b, RenderBatch::Chunk &ch) {
+  ch.vertices.clear();
+  ch.indices.clear();
+  ch.cmd_vertex.assign(1, 0);
+  ch.cmd_index.assign(1, 0);
+  ch.dirty_vertices.clear();
+  ch.dirty_indices.clear();
+  ch.upload = RenderBatch::Chunk::UPLOAD_ALL;
+  if (b.mapped) {
+    ch.vertex_ring.next();
+    ch.index_ring.next();
+  }
+}
+
+// the format of empty chunk `ch` for its first command `c`
+static void start(RenderBatch const &b, RenderBatch::Chunk &ch,
+                  RenderCmd const &c) {
+  ch.origin_x = std::min(c.x, c.x + c.w);
+  ch.origin_y = std::min(c.y, c.y + c.h);
+  ch.compact = !b.instanced && b.compact && in_range(ch, c);
+  if (!ch.compact)
+    ch.origin_x = ch.origin_y = 0.f;
+  u32 stride = b.instanced  ? sizeof(RenderCmd)
+               : ch.compact ? sizeof(RenderBatch::CompactVertex)
+                            : sizeof(RenderBatch::Vertex);
+  // a ring only holds elements of one size
+  if (ch.vertex_ring.stride && ch.vertex_ring.stride != stride) {
+    ch.vertex_ring.release();
+    ch.vertex_ring.stride = 0;
+  }
+  ch.stride = stride;
+}
+
+void RenderBatch::clear() {
+  for (auto &ch : chunks)
+    spare.push_back(std::move(ch));
+  chunks.clear();
+}
+
+RenderBatch::Chunk &RenderBatch::new_chunk(u32 j, u32 first_cmd,
+                                           RenderCmd const &first) {
+  auto it = chunks.begin() + j;
+  if (spare.empty()) {
+    it = chunks.emplace(it);
+  } else {
+    it = chunks.insert(it, std::move(spare.back()));
+    spare.pop_back();
+  }
+  reset(*this, *it);
+  start(*this, *it, first);
+  it->first_cmd = it->end_cmd = first_cmd;
+  return *it;
+}
+
+void RenderBatch::append(Chunk &ch, u64 nv, u64 ni, u8 *&v, Index *&idx) {
+  if (mapped) {
+    v = (u8 *)ch.vertex_ring.append(nv, ch.stride);
+    idx = ch.index_ring.append<Index>(ni);
+    return;
+  }
+  u64 v0 = ch.vertices.size(), i0 = ch.indices.size();
+  ch.vertices.resize(v0 + nv * ch.stride);
+  ch.indices.resize(i0 + ni);
+  v = ch.vertices.data() + v0;
+  idx = ch.indices.data() + i0;
+}
+
+void RenderBatch::rect(RenderCmd const &c) { add(&c, 1); }
+
+void RenderBatch::rects(RenderList const &list) {
+  add(list.data(), list.size());
+}
+
+void RenderBatch::add(RenderCmd const *cmds, u64 n) {
+  u64 k = chunks.empty() ? 0 : fill(chunks.back(), cmds, n);
+  u32 at = chunks.empty() ? 0 : chunks.back().end_cmd;
+  for (; k < n; at = chunks.back().end_cmd)
+    k += fill(new_chunk(chunks.size(), at, cmds[k]), cmds + k, n - k);
+}
+
+u64 RenderBatch::fill(Chunk &ch, RenderCmd const *cmds, u64 n) {
+  // The corner points of every box, counted first so that the buffers grow
+  // once. Boxes mostly share a few radii, the last one is remembered.
+  corners.resize(n);
+  u64 room = Chunk::MAX_VERTICES - ch.vertex_count();
+  u64 nv = 0, ni = 0, k = 0;
+  f32 last_r = 0.f;
+  u32 last_n = 0;
+  for (; k < n; k++) {
+    auto c = instanced ? cmds[k] : normalized(cmds[k]);
+    u32 cv = 1, ci = 0;
+    if (!instanced && c.r == 0) {
+      cv = 4;
+      ci = 6;
+    } else if (!instanced) {
+      if (c.r != last_r) {
+        last_r = c.r;
+        last_n = corner_points(c.r);
+      }
+      corners[k] = last_n;
+      cv = vertex_count(last_n);
+      ci = index_count(last_n);
+    }
+    if (nv + cv > room || (ch.compact && !in_range(ch, c)))
+      break;
+    nv += cv;
+    ni += ci;
+  }
+  // an empty chunk takes at least one command, as one is never more than
+  // MAX_VERTICES vertices nor out of the range of its origin
+  assert(k > 0 || ch.end_cmd > ch.first_cmd);
+  if (k == 0)
+    return 0;
+
+  u8 *v;
+  Index *idx;
+  u32 first = ch.vertex_count(), at_index = ch.index_count();
+  append(ch, nv, ni, v, idx);
+  ch.end_cmd += k;
+  ch.upload = Chunk::UPLOAD_ALL;
+  if (instanced) {
+    std::memcpy(v, cmds, k * sizeof(RenderCmd));
+    for (u64 j = 0; j < k; j++) {
+      ch.cmd_vertex.push_back(++first);
+      ch.cmd_index.push_back(0);
+    }
+    return k;
+  }
+  with_vertices(ch, v, [&](auto out) {
+    for (u64 j = 0; j < k; j++) {
+      auto c = normalized(cmds[j]);
+      if (c.r == 0) {
+        write_plain(c, out, idx, first);
+        out = out + 4;
+        idx += 6;
+        first += 4;
+        at_index += 6;
+      } else {
+        write_rounded(c, corners[j], out, idx, first);
+        out = out + vertex_count(corners[j]);
+        idx += index_count(corners[j]);
+        first += vertex_count(corners[j]);
+        at_index += index_count(corners[j]);
+      }
+      ch.cmd_vertex.push_back(first);
+      ch.cmd_index.push_back(at_index);
+    }
+  });
+  return k;
+}
+
+// [begin, end) to the last range if it continues it
+static void add_range(std::vector<std::pair<u64, u64>> &ranges, u64 begin,
+                      u64 end) {
+  if (!ranges.empty() && ranges.back().second == begin)
+    ranges.back().second = end;
+  else
+    ranges.push_back({begin, end});
+}
+
+// `ch` before its first rewrite since end()
+static void will_rewrite(RenderBatch const &b, RenderBatch::Chunk &ch) {
+  if (ch.upload != RenderBatch::Chunk::UPLOAD_NONE)
+    return;
+  ch.upload = RenderBatch::Chunk::UPLOAD_RANGES;
+  if (b.mapped) {
+    ch.vertex_ring.next_copy();
+    ch.index_ring.next_copy();
+  }
+}
+
+bool RenderBatch::rewrite(Chunk &ch, u32 k, RenderCmd const &cmd) {
+  u32 j = k - ch.first_cmd;
+  if (instanced) {
+    will_rewrite(*this, ch);
+    if (mapped) {
+      ch.vertex_ring.at<RenderCmd>(j) = cmd;
+    } else {
+      std::memcpy(ch.vertices.data() + j * ch.stride, &cmd, sizeof(cmd));
+      add_range(ch.dirty_vertices, j, j + 1);
+    }
+    return true;
+  }
+
+  auto c = normalized(cmd);
+  u32 n = c.r == 0 ? 0 : corner_points(c.r);
+  u32 nv = c.r == 0 ? 4 : vertex_count(n);
+  u32 ni = c.r == 0 ? 6 : index_count(n);
+  u32 v0 = ch.cmd_vertex[j], i0 = ch.cmd_index[j];
+  if (ch.cmd_vertex[j + 1] - v0 != nv || ch.cmd_index[j + 1] - i0 != ni)
+    return false;
+  if (ch.compact && !in_range(ch, c))
+    return false;
+  will_rewrite(*this, ch);
+  u8 *v = mapped ? ch.vertex_ring.data + ch.vertex_ring.base() * ch.stride
+                 : ch.vertices.data();
+  v += u64(v0) * ch.stride;
+  Index *idx = mapped ? &ch.index_ring.at<Index>(i0) : &ch.indices[i0];
+  with_vertices(ch, v, [&](auto out) {
+    if (c.r == 0)
+      write_plain(c, out, idx, v0);
+    else
+      write_rounded(c, n, out, idx, v0);
+  });
+  if (!mapped) {
+    add_range(ch.dirty_vertices, v0, v0 + nv);
+    add_range(ch.dirty_indices, i0, i0 + ni);
+  }
+  return true;
+}
+
+bool RenderBatch::patch(RenderList const &old, RenderList const &cur,
+                        ListDiff &diff) {
+  diff_lists(old, cur, diff);
+  if (diff.same_order && diff.updated == 0)
+    return false;
+  if (diff.same_order) {
+    // in place, the changed commands come in order
+    rebuilt.clear();
+    u32 j = 0;
+    for (u32 k : diff.changed) {
+      while (chunks[j].end_cmd <= k)
+        j++;
+      auto &ch = chunks[j];
+      if (!rebuilt.empty() && rebuilt.back() == j)
+        continue;
+      if (!rewrite(ch, k, cur[k]))
+        rebuilt.push_back(j);
+    }
+    // The chunks where the geometry of some command changed size, from
+    // the last so that inserting the rest of one that no longer fits does
+    // not move the others.
+    for (u32 r = rebuilt.size(); r-- > 0;) {
+      u32 j = rebuilt[r];
+      u32 at = chunks[j].first_cmd, end = chunks[j].end_cmd;
+      reset(*this, chunks[j]);
+      start(*this, chunks[j], cur[at]);
+      chunks[j].end_cmd = at;
+      at += fill(chunks[j], cur.data() + at, end - at);
+      for (; at < end; at = chunks[j].end_cmd)
+        fill(new_chunk(++j, at, cur[at]), cur.data() + at, end - at);
+    }
+    return true;
+  }
+
+  // The chunks whose commands all come again, one after the other, are
+  // kept, with the changed ones rewritten. The commands of the others are
+  // tessellated again, after the chunk before them.
+  kept.swap(chunks);
+  chunks.clear();
+  moved.clear();
+  for (u32 k = 0; k < cur.size();) {
+    u32 o = diff.old_index[k];
+    auto it = std::lower_bound(
+        kept.begin(), kept.end(), o,
+        [](Chunk const &ch, u32 o) { return ch.first_cmd < o; });
+    u32 n = it == kept.end() || it->first_cmd != o ? 0 : it->end_cmd - o;
+    bool same = n > 0 && k + n <= cur.size();
+    for (u32 i = 1; same && i < n; i++)
+      same = diff.old_index[k + i] == o + i;
+    if (!same) {
+      k++;
+      continue;
+    }
+    moved.push_back({k, u32(it - kept.begin())});
+    k += n;
+  }
+  // the buffers of the others are reused
+  rebuilt.clear();
+  for (auto [k, j] : moved)
+    rebuilt.push_back(j);
+  std::sort(rebuilt.begin(), rebuilt.end());
+  for (u32 j = 0, r = 0; j < kept.size(); j++) {
+    if (r < rebuilt.size() && rebuilt[r] == j)
+      r++;
+    else
+      spare.push_back(std::move(kept[j]));
+  }
+
+  // the commands from `at` are not in a chunk yet
+  u32 at = 0;
+  for (auto [k, j] : moved) {
+    if (at < k)
+      add(cur.data() + at, k - at);
+    at = k;
+    auto &ch = chunks.emplace_back(std::move(kept[j]));
+    u32 o = ch.first_cmd, n = ch.end_cmd - o;
+    ch.first_cmd = k;
+    ch.end_cmd = k + n;
+    bool same_size = true;
+    for (u32 i = 0; same_size && i < n; i++) {
+      if (!(old[o + i] == cur[k + i]))
+        same_size = rewrite(ch, k + i, cur[k + i]);
+    }
+    if (same_size) {
+      at = k + n;
+    } else {
+      // its commands with those after it
+      spare.push_back(std::move(ch));
+      chunks.pop_back();
+    }
+  }
+  if (at < cur.size())
+    add(cur.data() + at, cur.size() - at);
+  kept.clear();
+  return true;
+}
+
 void RenderBatch::end() {
-  glNamedBufferData(vbo, sizeof(Vertex) * vertices.size(), vertices.data(),
-                    GL_DYNAMIC_DRAW);
-  glNamedBufferData(ibo, sizeof(Index) * indices.size(), indices.data(),
-                    GL_DYNAMIC_DRAW);
+  for (auto &ch : chunks) {
+    if (!ch.vao)
+      create_gl_objects(*this, ch);
+    auto kind = ch.upload;
+    ch.upload = Chunk::UPLOAD_NONE;
+    if (kind == Chunk::UPLOAD_RANGES) {
+      for (auto [begin, end] : ch.dirty_vertices)
+        glNamedBufferSubData(ch.vbo, begin * ch.stride,
+                             (end - begin) * ch.stride,
+                             ch.vertices.data() + begin * ch.stride);
+      for (auto [begin, end] : ch.dirty_indices)
+        glNamedBufferSubData(ch.ibo, begin * sizeof(Index),
+                             (end - begin) * sizeof(Index),
+                             ch.indices.data() + begin);
+    }
+    ch.dirty_vertices.clear();
+    ch.dirty_indices.clear();
+    if (kind != Chunk::UPLOAD_ALL)
+      continue;
+    // with the rings, already written, their buffers only change when they
+    // grow
+    set_format(*this, ch);
+    if (mapped)
+      continue;
+    glNamedBufferData(ch.vbo, ch.vertices.size(), ch.vertices.data(),
+                      GL_DYNAMIC_DRAW);
+    if (!instanced)
+      glNamedBufferData(ch.ibo, sizeof(Index) * ch.indices.size(),
+                        ch.indices.data(), GL_DYNAMIC_DRAW);
+  }
 }
+
 void RenderBatch::render() {
-  glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr);
+  for (auto &ch : chunks) {
+    glBindVertexArray(ch.vao);
+    if (instanced) {
+      // a strip of the four corners per box
+      if (mapped)
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4,
+                                          ch.vertex_count(),
+                                          ch.vertex_ring.base());
+      else
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, ch.vertex_count());
+    } else {
+      // what the positions of the chunk are in, see BaseShader
+      glUniform2f(2, ch.origin_x, ch.origin_y);
+      glUniform1f(3, ch.compact ? 1.f / SUBPIXELS : 1.f);
+      // the indices count from the first vertex of the region
+      auto offset = (void const *)(ch.index_ring.base() * sizeof(Index));
+      if (mapped)
+        glDrawElementsBaseVertex(GL_TRIANGLES, ch.index_count(),
+                                 GL_UNSIGNED_SHORT, offset,
+                                 ch.vertex_ring.base());
+      else
+        glDrawElements(GL_TRIANGLES, ch.index_count(), GL_UNSIGNED_SHORT,
+                       nullptr);
+    }
+    if (mapped) {
+      ch.vertex_ring.fence();
+      if (!instanced)
+        ch.index_ring.fence();
+    }
+  }
 }
-void RenderBatch::use() { glBindVertexArray(vao); }
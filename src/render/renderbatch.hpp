@@ -4,27 +4,147 @@
 #include "../defines.hpp"
 #include "color.hpp"
 #include "renderlist.hpp"
+#include <utility>
 #include <vector>
 
+// A GL buffer of REGIONS regions, with immutable storage that stays mapped.
+// Every rebuild or patch of a chunk is written to the next region while the
+// GPU can still be drawing from the others, and a fence per region tells
+// when it is done with it. The storage only grows, geometrically, when a
+// region is too small.
+struct MappedRing {
+  static constexpr u32 REGIONS = 3;
+  u32 buffer = 0;
+  u8 *data = nullptr;
+  u32 stride = 0;
+  // in elements, of a region and of the current one
+  u64 capacity = 0;
+  u64 used = 0;
+  u32 region = 0;
+  // GLsync of the last draw from each region
+  void *fences[REGIONS] = {};
+
+  // starts the next region, once the GPU is done with it
+  void next();
+  // the next region too, with a copy of what the current one holds
+  void next_copy();
+  // room for `n` more elements of `stride` bytes in the current region
+  void *append(u64 n, u32 stride);
+  template <typename T> T *append(u64 n) {
+    return static_cast<T *>(append(n, sizeof(T)));
+  }
+  // first element of the current region
+  u64 base() const { return region * capacity; }
+  template <typename T> T &at(u64 i) {
+    return reinterpret_cast<T *>(data)[base() + i];
+  }
+  // until the GPU is done with the current region
+  void wait();
+  // after a draw from the current region
+  void fence();
+  void release();
+};
+
+// The geometry of a RenderList, on the GPU after end(), in chunks of at
+// most Chunk::MAX_VERTICES vertices. Commands are either tessellated in
+// triangles, drawn by BaseShader, or, when `instanced`, kept as one
+// instance each, drawn by BoxShader.
 struct RenderBatch {
   struct Vertex {
     f32 x, y;
     Color c;
     // texture => for text
   };
-  using Index = u32;
-  std::vector<Vertex> vertices;
-  std::vector<Index> indices;
-  u32 vbo, ibo, vao;
+  // in 1/SUBPIXELS of a pixel from the origin of its chunk
+  struct CompactVertex {
+    i16 x, y;
+    Color c;
+  };
+  static constexpr f32 SUBPIXELS = 8.f;
+  using Index = u16;
+
+  // A run of consecutive commands in buffers of its own, so that it is
+  // rebuilt, uploaded and drawn without the others. Its indices count from
+  // its first vertex. Instanced, its vertices are the commands.
+  struct Chunk {
+    static constexpr u32 MAX_VERTICES = 65536;
+    // the commands [first_cmd, end_cmd) of the batch
+    u32 first_cmd = 0, end_cmd = 0;
+    // of CompactVertex from the origin instead of Vertex
+    bool compact = false;
+    f32 origin_x = 0.f, origin_y = 0.f;
+    u32 stride = 0;
+    std::vector<u8> vertices;
+    std::vector<Index> indices;
+    // where the vertices and indices of each command start, and where they
+    // end after the last one
+    std::vector<u32> cmd_vertex = {0}, cmd_index = {0};
+    // instead of the vectors when the batch is `mapped`
+    MappedRing vertex_ring, index_ring;
+    // what end() has to upload, without the rings: everything or the ranges
+    // of elements that patch() wrote
+    enum Upload : u8 { UPLOAD_NONE, UPLOAD_RANGES, UPLOAD_ALL };
+    Upload upload = UPLOAD_ALL;
+    std::vector<std::pair<u64, u64>> dirty_vertices, dirty_indices;
+    u32 vbo = 0, ibo = 0, vao = 0;
+    Chunk(Chunk const &) = delete;
+    Chunk &operator=(Chunk const &) = delete;
+    Chunk() = default;
+    ~Chunk();
+    Chunk(Chunk &&);
+    Chunk &operator=(Chunk &&);
+    u32 vertex_count() const { return cmd_vertex.back(); }
+    u32 index_count() const { return cmd_index.back(); }
+  };
+
+  std::vector<Chunk> chunks;
+  // the chunks of before the last clear(), reused with their buffers
+  std::vector<Chunk> spare;
+  // points per corner of each command in fill(), scratch space
+  std::vector<u32> corners;
+  // scratch space of patch(): the chunks rebuilt, the chunks of the old
+  // list, and where the commands of those kept start in the new one
+  std::vector<u32> rebuilt;
+  std::vector<Chunk> kept;
+  std::vector<std::pair<u32, u32>> moved;
+  // set before the first command, the format of the chunks depends on them
+  bool instanced = false;
+  // CompactVertex in the chunks whose first box is within their range,
+  // ignored when instanced
+  bool compact = false;
+  // Written straight to the rings of the chunks instead of their vectors,
+  // which needs a GL context. Set before the first command too.
+  bool mapped = false;
   RenderBatch(RenderBatch const &) = delete;
   RenderBatch &operator=(RenderBatch const &) = delete;
-  RenderBatch();
-  ~RenderBatch();
-  RenderBatch(RenderBatch &&);
-  RenderBatch &operator=(RenderBatch &&);
+  RenderBatch() = default;
+  RenderBatch(RenderBatch &&) = default;
+  RenderBatch &operator=(RenderBatch &&) = default;
+  void clear();
   void rect(RenderCmd const &c);
+  // all the commands of `list`
+  void rects(RenderList const &list);
+  void add(RenderCmd const *cmds, u64 n);
+  // an empty chunk at `j` in `chunks`, for the commands from `first_cmd`,
+  // in the format for the first of them
+  Chunk &new_chunk(u32 j, u32 first_cmd, RenderCmd const &first);
+  // the first ones of the `n` commands `cmds` that fit in `ch`, with the
+  // buffers grown once; returns how many
+  u64 fill(Chunk &ch, RenderCmd const *cmds, u64 n);
+  // room for `nv` more vertices and `ni` more indices in `ch`
+  void append(Chunk &ch, u64 nv, u64 ni, u8 *&v, Index *&idx);
+  // Brings the batch, which holds `old`, to `cur`. Only the changed
+  // commands are written again, in place, and the chunks where one changed
+  // size are rebuilt, split in two if they no longer fit. When commands
+  // were added, removed or moved, the chunks whose commands still come one
+  // after the other are kept, the others rebuilt. Returns false if nothing
+  // changed, `diff` says what did.
+  bool patch(RenderList const &old, RenderList const &cur, ListDiff &diff);
+  // Command `k` in place, false if its geometry does not have the same
+  // size. Mapped, the first one since end() moves the chunk to the next
+  // regions of its rings, so the GPU can still draw from the current ones.
+  bool rewrite(Chunk &ch, u32 k, RenderCmd const &c);
   void end();
-  void use();
   void render();
 };
 
@@ -1,209 +1,1000 @@
 #include "renderbox.hpp"
 
 #include "../file/filedata.hpp"
+#include "../file/hash.hpp"
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <queue>
 
-Value get_prop_w_style(LayoutElem const &elt, Style const *style,
-                       char const *name, Value default_val = 0.f) {
-  if (style) {
-    auto it = style->values.find(name);
-    if (it != style->values.end())
-      return it->second;
+#define RESOLVE resolve_units(cv.width, cv.height)
+
+Length::Length(Value v) {
+  if (v.kind == Value::PC) {
+    pc = v.val / 100.f;
+    return;
+  }
+  if (v.kind == Value::FIT) {
+    abs = -INFINITY;
+    return;
   }
-  return elt.get_prop(name, default_val);
+  assert(v.kind == Value::NO_UNIT);
+  abs = v.val;
 }
 
-#define RESOLVE resolve_units(cv.width, cv.height)
-void assign_inset(Inset &toassign, std::string name, LayoutElem const &elt,
-                  Style const *style, CV const &cv) {
-  toassign.l = toassign.r = toassign.b = toassign.t =
-      get_prop_w_style(elt, style, name.c_str()).RESOLVE;
-  toassign.l = toassign.r =
-      get_prop_w_style(elt, style, (name + "_x").c_str(), toassign.l).RESOLVE;
-  toassign.t = toassign.b =
-      get_prop_w_style(elt, style, (name + "_y").c_str(), toassign.t).RESOLVE;
-  toassign.t =
-      get_prop_w_style(elt, style, (name + "_t").c_str(), toassign.t).RESOLVE;
-  toassign.b =
-      get_prop_w_style(elt, style, (name + "_b").c_str(), toassign.b).RESOLVE;
-  toassign.l =
-      get_prop_w_style(elt, style, (name + "_l").c_str(), toassign.l).RESOLVE;
-  toassign.r =
-      get_prop_w_style(elt, style, (name + "_r").c_str(), toassign.r).RESOLVE;
-}
-
-void assign_props(RenderBox &rb, LayoutElem const &elt, CV const &cv) {
-  Style const *style = nullptr;
-  auto style_id = elt.get_prop("style", Value(Value::STYLE, i32(-1)));
+// `base` is the base property of an inset group, the _x, _y, _t, _b, _l and
+// _r variants follow it (see PROPERTIES)
+void assign_inset(Inset &toassign, PropId base, PropBlock const &props,
+                  CV const &cv) {
+  auto prop = [&](u32 offset) { return PropId(base + offset); };
+  Value l, r, t, b;
+  l = r = b = t = props.get(base).RESOLVE;
+  l = r = props.get(prop(1), l).RESOLVE;
+  t = b = props.get(prop(2), t).RESOLVE;
+  t = props.get(prop(3), t).RESOLVE;
+  b = props.get(prop(4), b).RESOLVE;
+  l = props.get(prop(5), l).RESOLVE;
+  r = props.get(prop(6), r).RESOLVE;
+  toassign = {l, r, t, b};
+}
+
+// properties that only matter for the element's place in its parent, left
+// out of the style key so that more elements share their style
+constexpr u32 PLACEMENT_PROPS = 1u << PROP_W | 1u << PROP_H | 1u << PROP_LOC;
+
+ResolvedStyle resolve_style(PropSlice const &elt_props,
+                            PropBlock const *inherited, StyleCache &styles,
+                            CV const &cv) {
+  auto style_id = elt_props.get(PROP_STYLE);
   assert(style_id.kind == Value::STYLE);
+
+  PropBlock props;
+  if (inherited)
+    props.merge(*inherited);
+  props.merge(styles.document);
   if (style_id.val_int != -1) {
-    style = &cv.style[style_id.val_int];
-  }
-
-  rb.width = get_prop_w_style(elt, style, "w", INFINITY).RESOLVE;
-  rb.height = get_prop_w_style(elt, style, "h", INFINITY).RESOLVE;
-  rb.gap = get_prop_w_style(elt, style, "gap").RESOLVE;
-  assign_inset(rb.padding, "padding", elt, style, cv);
-  assign_inset(rb.margin, "margin", elt, style, cv);
-  rb.background_color =
-      get_prop_w_style(elt, style, "background_color", Value(Value::COLOR, 0));
-  rb.corner_radius = get_prop_w_style(elt, style, "corner_radius").RESOLVE;
-}
-
-RenderBox::RenderBox(LayoutElem const &elt, CV const &cv) {
-  for (auto const &c : elt.children) {
-    children.emplace_back(c, cv);
-  }
-  if (elt.kind == "layers") {
-    children_mode = LAYER;
-    assign_props(*this, elt, cv);
-  } else if (elt.kind == "box") {
-    children_mode = UNIQUE;
-    assign_props(*this, elt, cv);
-    assert(children.size() <= 1);
-  } else if (elt.kind == "column") {
-    children_mode = COLUMN;
-    assign_props(*this, elt, cv);
-  } else if (elt.kind == "row") {
-    children_mode = ROW;
-    assign_props(*this, elt, cv);
-  } else if (elt.kind == "hsplit") {
-    children_mode = ROW;
-    assign_props(*this, elt, cv);
-    assert(children.size() == 2);
-    auto loc_prop = elt.get_prop("loc", Value(Value::PC, 50.f));
-    assert(loc_prop.kind == Value::PC);
-    children[0].width = loc_prop;
-    children[1].width = Value(Value::PC, 100.f - loc_prop.val);
-  } else if (elt.kind == "vsplit") {
-    children_mode = COLUMN;
-    assign_props(*this, elt, cv);
-    assert(children.size() == 2);
-    auto loc_prop = elt.get_prop("loc", Value(Value::PC, 50.f));
-    assert(loc_prop.kind == Value::PC);
-    children[0].height = loc_prop;
-    children[1].height = Value(Value::PC, 100.f - loc_prop.val);
-  }
-}
-
-void RenderBox::render(f32 x, f32 y, f32 w, f32 h, RenderList &list) const {
-  if (background_color.a != 0) {
-    // render a rectangle:
-    RenderCmd cmd;
-    cmd.x = x + margin.l.get_f32(w);
-    cmd.w = w - margin.l.get_f32(w) - margin.r.get_f32(w);
-    cmd.y = y + margin.t.get_f32(h);
-    cmd.h = h - margin.t.get_f32(h) - margin.b.get_f32(h);
-    cmd.r = corner_radius.get_f32(std::min(w, h) / 2.f);
-    cmd.c = background_color;
-    list.push_back(cmd);
-  }
-  f32 new_x = x + margin.l.get_f32(w) + padding.l.get_f32(w);
-  f32 new_y = y + margin.t.get_f32(h) + padding.t.get_f32(h);
-  f32 new_w = w - (margin.l.get_f32(w) + padding.l.get_f32(w) +
-                   margin.r.get_f32(w) + padding.r.get_f32(w));
-  f32 new_h = h - (margin.t.get_f32(h) + padding.t.get_f32(h) +
-                   margin.b.get_f32(h) + padding.b.get_f32(h));
-  if (children_mode == LAYER) {
-    for (auto const &c : children) {
-      auto c_w = new_w, c_h = new_h;
-      if (c.width.val != INFINITY)
-        c_w = c.width.get_f32(c_w);
-      if (c.height.val != INFINITY)
-        c_h = c.height.get_f32(c_h);
-      c.render(new_x, new_y, c_w, c_h, list);
-    }
-  } else if (children_mode == UNIQUE) {
-    if (children.size() > 0) {
-      auto const &c = children[0];
-      if (c.width.val != INFINITY)
-        new_w = c.width.get_f32(new_w);
-      if (c.height.val != INFINITY)
-        new_h = c.height.get_f32(new_h);
-      c.render(new_x, new_y, new_w, new_h, list);
-    }
-  } else if (children_mode == COLUMN) {
-    f32 rem_h = new_h;
-    u32 rem_h_cnt = 0;
-    auto gap_val = gap.get_f32(h);
-    rem_h -= gap_val * std::max(0.f, f32(children.size()) - 1.f);
-    for (auto const &c : children) {
-      if (c.height.val != INFINITY) {
-        rem_h -= c.height.get_f32(h);
-      } else {
-        rem_h_cnt++;
-      }
+    props.merge(cv.style[style_id.val_int].values);
+  }
+  props.merge(elt_props);
+
+  ResolvedStyle rs;
+  rs.gap = props.get(PROP_GAP).RESOLVE;
+  assign_inset(rs.padding, PROP_PADDING, props, cv);
+  assign_inset(rs.margin, PROP_MARGIN, props, cv);
+  rs.background_color = props.get(PROP_BACKGROUND_COLOR);
+  rs.corner_radius = props.get(PROP_CORNER_RADIUS).RESOLVE;
+  // the sizes are not in the key of the record, RenderTree::resolve checks
+  // them
+  for (u32 m = props.present & ~PLACEMENT_PROPS; m; m &= m - 1) {
+    auto kind = props.slots[__builtin_ctz(m)].kind;
+    rs.viewport |= kind == Value::VW || kind == Value::VH;
+  }
+  rs.inherited = styles.snapshot(props);
+  return rs;
+}
+
+bool StyleCache::Key::operator==(Key const &o) const {
+  return std::memcmp(this, &o, sizeof(Key)) == 0;
+}
+
+u64 StyleCache::KeyHash::operator()(Key const &k) const {
+  u32 n = __builtin_popcount(k.present);
+  return hash_bytes(&k, offsetof(Key, values) + n * sizeof(Value));
+}
+
+ResolvedStyle const *StyleCache::get(PropSlice const &elt_props,
+                                     PropBlock const *inherited,
+                                     CV const &cv) {
+  Key key = {};
+  key.inherited = inherited;
+  key.present = elt_props.present & ~PLACEMENT_PROPS;
+  key.vw = cv.width;
+  key.vh = cv.height;
+  u32 n = 0;
+  for (u32 m = elt_props.present, i = 0; m; m &= m - 1, i++) {
+    if (key.present & m & -m)
+      key.values[n++] = elt_props.values[i];
+  }
+  auto [it, inserted] = index.try_emplace(key, nullptr);
+  if (inserted) {
+    records.push_back(resolve_style(elt_props, inherited, *this, cv));
+    it->second = &records.back();
+  }
+  return it->second;
+}
+
+PropBlock const *StyleCache::snapshot(PropBlock const &props) {
+  Key key = {};
+  key.present = props.present & INHERITED_PROPS;
+  if (key.present == 0)
+    return nullptr;
+  u32 n = 0;
+  for (u32 m = key.present; m; m &= m - 1)
+    key.values[n++] = props.slots[__builtin_ctz(m)];
+  auto [it, inserted] = snapshot_index.try_emplace(key, nullptr);
+  if (inserted) {
+    PropBlock &s = snapshots.emplace_back();
+    for (u32 m = key.present; m; m &= m - 1) {
+      u32 p = __builtin_ctz(m);
+      s.set(PropId(p), props.slots[p]);
     }
-    if (rem_h_cnt == 0) {
-      for (auto const &c : children) {
-        f32 c_h = c.height.get_f32(h);
-        c.render(new_x, new_y, new_w, c_h, list);
-        new_y += c_h + gap_val;
-      }
-    } else if (rem_h <= 0.f) {
-      for (auto const &c : children) {
-        f32 c_h = 0;
-        if (c.height.val != INFINITY) {
-          c_h = c.height.get_f32(h);
-          c.render(new_x, new_y, new_w, c_h, list);
-        }
-        new_y += c_h + gap_val;
+    it->second = &s;
+  }
+  return it->second;
+}
+
+void StyleCache::forget(std::vector<bool> const &changed) {
+  std::erase_if(index, [&](auto const &entry) {
+    Key const &k = entry.first;
+    if (!(k.present & 1u << PROP_STYLE))
+      return false;
+    u32 at = __builtin_popcount(k.present & ((1u << PROP_STYLE) - 1));
+    i32 s = k.values[at].val_int;
+    return s >= 0 && u32(s) < changed.size() && changed[s];
+  });
+}
+
+void StyleCache::reset(CV const &cv) {
+  index.clear();
+  previous.swap(records);
+  records.clear();
+  snapshot_index.clear();
+  snapshots.clear();
+  document = PropBlock();
+  for (auto const &s : cv.style) {
+    if (s.document)
+      document.merge(s.values);
+  }
+}
+
+void RenderBoxes::clear() {
+  parent.clear();
+  first_child.clear();
+  child_count.clear();
+  mode.clear();
+  flags.clear();
+  width.clear();
+  height.clear();
+  style.clear();
+  rect.clear();
+  offered.clear();
+  subtree_size.clear();
+  path.clear();
+  bounds.clear();
+  measure_key.clear();
+  measured.clear();
+  child_size.clear();
+  child_offer.clear();
+}
+
+void RenderBoxes::reserve(u32 n) {
+  parent.reserve(n);
+  first_child.reserve(n);
+  child_count.reserve(n);
+  mode.reserve(n);
+  flags.reserve(n);
+  width.reserve(n);
+  height.reserve(n);
+  style.reserve(n);
+  rect.reserve(n);
+  offered.reserve(n);
+  subtree_size.reserve(n);
+  path.reserve(n);
+  bounds.reserve(n);
+  measure_key.reserve(n);
+  measured.reserve(n);
+  child_size.reserve(n);
+  child_offer.reserve(n);
+}
+
+// whether the children of an element with style `a` are placed the same as
+// with `b`
+bool same_arrangement(ResolvedStyle const &a, ResolvedStyle const &b) {
+  return a.gap == b.gap && a.margin == b.margin && a.padding == b.padding;
+}
+
+RenderBoxes::ChildrenMode mode_of(Atom kind) {
+  switch (kind) {
+  case ATOM_LAYERS:
+    return RenderBoxes::LAYER;
+  case ATOM_COLUMN:
+  case ATOM_VSPLIT:
+    return RenderBoxes::COLUMN;
+  case ATOM_ROW:
+  case ATOM_HSPLIT:
+    return RenderBoxes::ROW;
+  default:
+    return RenderBoxes::UNIQUE;
+  }
+}
+
+void RenderTree::update(CV const &cv, u32 root, StyleCache &styles) {
+  std::swap(boxes, old);
+  boxes.clear();
+  node_of.clear();
+  style_of.clear();
+  viewport_boxes.clear();
+  match.clear();
+  box_of.assign(cv.nodes.size(), NO_NODE);
+  // at most that many
+  boxes.reserve(cv.nodes.size());
+  node_of.reserve(cv.nodes.size());
+  style_of.reserve(cv.nodes.size());
+  match.reserve(cv.nodes.size());
+  auto &b = boxes;
+
+  // appends the box of `node`, child `k` of `parent`, matched with box `m`
+  // of the old tree
+  auto add = [&](u32 node, u32 parent, u32 k, u32 m) {
+    auto const &elt = cv.nodes[node];
+    u32 i = b.size();
+    b.parent.push_back(parent);
+    b.first_child.push_back(0);
+    b.child_count.push_back(elt.child_count);
+    b.mode.push_back(mode_of(elt.kind));
+    b.width.push_back(Length());
+    b.height.push_back(Length());
+    b.style.push_back(nullptr);
+    b.subtree_size.push_back(1);
+    u64 parent_path = parent == NO_NODE ? 0 : b.path[parent];
+    b.path.push_back(u32(hash_mix((parent_path << 32 | k) + 1)));
+    b.child_size.push_back(Size());
+    b.child_offer.push_back(Size());
+    node_of.push_back(node);
+    box_of[node] = i;
+    style_of.push_back(-1);
+    match.push_back(m);
+    u8 viewport = 0;
+    if (resolve(cv, i, styles)) {
+      viewport = RenderBoxes::VIEWPORT;
+      viewport_boxes.push_back(i);
+    }
+    auto const *style = b.style[i];
+    if (m == NO_NODE) {
+      b.flags.push_back(RenderBoxes::DIRTY | viewport);
+      b.rect.push_back(Rect());
+      b.offered.push_back(Size());
+      b.bounds.push_back(Bounds());
+      b.measure_key.push_back(Size());
+      b.measured.push_back(Size());
+      return;
+    }
+    u8 flags = old.flags[m] & (RenderBoxes::DIRTY | RenderBoxes::HIDDEN |
+                               RenderBoxes::MEASURED);
+    if (b.mode.back() != old.mode[m] || elt.child_count != old.child_count[m] ||
+        !same_arrangement(*style, *old.style[m]))
+      flags |= RenderBoxes::DIRTY;
+    b.flags.push_back(flags | viewport);
+    b.rect.push_back(old.rect[m]);
+    b.offered.push_back(old.offered[m]);
+    b.bounds.push_back(old.bounds[m]);
+    b.measure_key.push_back(old.measure_key[m]);
+    b.measured.push_back(old.measured[m]);
+  };
+
+  add(root, NO_NODE, 0, old.size() > 0 ? 0 : NO_NODE);
+  // the boxes are their own queue
+  for (u32 i = 0; i < b.size(); i++) {
+    auto const &elt = cv.nodes[node_of[i]];
+    u32 m = match[i];
+    b.first_child[i] = b.size();
+    u32 k = 0;
+    for (u32 c = elt.first_child; c != NO_NODE;
+         c = cv.nodes[c].next_sibling, k++) {
+      u32 cm = NO_NODE;
+      if (m != NO_NODE && k < old.child_count[m])
+        cm = old.first_child[m] + k;
+      add(c, i, k, cm);
+    }
+    assert(b.mode[i] != RenderBoxes::UNIQUE || b.child_count[i] <= 1);
+
+    u32 first = b.first_child[i], n = b.child_count[i];
+    // their size changes how the other children are placed
+    for (u32 c = first; c < first + n; c++) {
+      u32 cm = match[c];
+      if (cm != NO_NODE &&
+          !(b.width[c] == old.width[cm] && b.height[c] == old.height[cm])) {
+        b.flags[i] |= RenderBoxes::DIRTY;
+        b.flags[c] &= ~RenderBoxes::MEASURED;
       }
+    }
+  }
+
+  // children come after their parent
+  for (u32 i = b.size(); i-- > 1;) {
+    if (b.flags[i] & (RenderBoxes::DIRTY | RenderBoxes::CHILD_DIRTY)) {
+      // the size of a box sized to its content changes with it
+      bool fit = b.width[i].is_fit() || b.height[i].is_fit();
+      b.flags[b.parent[i]] |=
+          fit ? RenderBoxes::DIRTY : RenderBoxes::CHILD_DIRTY;
+    }
+    b.subtree_size[b.parent[i]] += b.subtree_size[i];
+  }
+  // measures depend on the whole subtree
+  for (u32 i = 0; i < b.size(); i++) {
+    if (b.flags[i] & (RenderBoxes::DIRTY | RenderBoxes::CHILD_DIRTY))
+      b.flags[i] &= ~RenderBoxes::MEASURED;
+  }
+}
+
+bool RenderTree::resolve(CV const &cv, u32 i, StyleCache &styles,
+                         ResolvedStyle const *style) {
+  auto &b = boxes;
+  u32 node = node_of[i], parent = b.parent[i];
+  auto elt_props = cv.props(node);
+  if (!style) {
+    auto const *inherited =
+        parent == NO_NODE ? nullptr : b.style[parent]->inherited;
+    style = styles.get(elt_props, inherited, cv);
+  }
+  b.style[i] = style;
+
+  // same cascade as in resolve_style, without merging everything (neither
+  // is inherited)
+  auto style_id = elt_props.get(PROP_STYLE);
+  auto get = [&](PropId p) {
+    if (elt_props.has(p))
+      return elt_props.get(p);
+    if (style_id.val_int != -1 && cv.style[style_id.val_int].values.has(p))
+      return cv.style[style_id.val_int].values.get(p);
+    return styles.document.get(p);
+  };
+  Value w = get(PROP_W), h = get(PROP_H);
+  // before resolving them, which takes their units
+  bool viewport = b.style[i]->viewport || w.kind == Value::VW ||
+                  w.kind == Value::VH || h.kind == Value::VW ||
+                  h.kind == Value::VH;
+  b.width[i] = w.RESOLVE;
+  b.height[i] = h.RESOLVE;
+  style_of[i] = style_id.val_int;
+
+  if (parent == NO_NODE)
+    return viewport;
+  Atom kind = cv.nodes[node_of[parent]].kind;
+  if (kind == ATOM_HSPLIT || kind == ATOM_VSPLIT) {
+    // the size of the children of splits is set by the split
+    auto loc_prop = cv.props(node_of[parent]).get(PROP_LOC);
+    assert(b.child_count[parent] == 2 && loc_prop.kind == Value::PC);
+    auto &size = kind == ATOM_HSPLIT ? b.width : b.height;
+    size[i] = i == b.first_child[parent]
+                  ? loc_prop
+                  : Value(Value::PC, 100.f - loc_prop.val);
+  }
+  return viewport;
+}
+
+bool RenderTree::restyle(CV const &cv, CVChanges const &changes,
+                         StyleCache &styles) {
+  auto &b = boxes;
+  if (b.size() == 0)
+    return false;
+  // indexed by style, so each box is checked once
+  std::vector<bool> changed(cv.style.size());
+  for (u32 s : changes.styles) {
+    if (cv.style[s].document)
+      return false;
+    changed[s] = true;
+  }
+  if (!changes.styles.empty())
+    styles.forget(changed);
+
+  std::vector<u32> pending;
+  for (u32 node : changes.nodes) {
+    if (node < box_of.size() && box_of[node] != NO_NODE)
+      pending.push_back(box_of[node]);
+  }
+  if (!changes.styles.empty()) {
+    for (u32 i = 0; i < b.size(); i++) {
+      if (style_of[i] >= 0 && changed[style_of[i]])
+        pending.push_back(i);
+    }
+  }
+  restyle_boxes(cv, pending, styles, false);
+  return true;
+}
+
+void RenderTree::resize(CV const &cv, StyleCache &styles) {
+  // the ones still depending on the viewport are put back
+  std::vector<u32> pending;
+  pending.swap(viewport_boxes);
+  for (u32 i : pending)
+    boxes.flags[i] &= ~RenderBoxes::VIEWPORT;
+  restyle_boxes(cv, pending, styles, true);
+}
+
+void RenderTree::restyle_boxes(CV const &cv, std::vector<u32> &pending,
+                               StyleCache &styles, bool resized) {
+  auto &b = boxes;
+  // the new style of each old one, the inherited properties are kept
+  // unresolved so a resize does not change them
+  std::unordered_map<ResolvedStyle const *, ResolvedStyle const *> same;
+  // parents first, so that children inherit from their new style. The
+  // children added on the way are few, they wait in a heap.
+  std::sort(pending.begin(), pending.end());
+  std::priority_queue<u32, std::vector<u32>, std::greater<u32>> children;
+
+  // boxes that became dirty, their ancestors are marked below
+  std::vector<u32> dirty;
+  u32 last = NO_NODE;
+  for (u32 k = 0; k < pending.size() || !children.empty();) {
+    u32 i;
+    if (k < pending.size() &&
+        (children.empty() || pending[k] <= children.top())) {
+      i = pending[k++];
     } else {
-      rem_h = rem_h / f32(rem_h_cnt);
-      for (auto const &c : children) {
-        f32 c_h = rem_h;
-        if (c.height.val != INFINITY) {
-          c_h = c.height.get_f32(h);
-        }
-        c.render(new_x, new_y, new_w, c_h, list);
-        new_y += c_h + gap_val;
+      i = children.top();
+      children.pop();
+    }
+    if (i == last)
+      continue;
+    last = i;
+    auto const *old_style = b.style[i];
+    Length w = b.width[i], h = b.height[i];
+    u8 &flags = b.flags[i];
+    ResolvedStyle const *known = nullptr;
+    if (resized) {
+      auto it = same.find(old_style);
+      known = it == same.end() ? nullptr : it->second;
+    }
+    bool viewport = resolve(cv, i, styles, known);
+    if (resized && !known)
+      same.emplace(old_style, b.style[i]);
+    if (viewport && !(flags & RenderBoxes::VIEWPORT))
+      viewport_boxes.push_back(i);
+    flags = (flags & ~RenderBoxes::VIEWPORT) |
+            (viewport ? RenderBoxes::VIEWPORT : 0);
+    auto const *style = b.style[i];
+    if (!same_arrangement(*style, *old_style)) {
+      flags = (flags | RenderBoxes::DIRTY) & ~RenderBoxes::MEASURED;
+      dirty.push_back(i);
+    }
+    // as in update(), its size changes how the other children are placed
+    if (i > 0 && !(w == b.width[i] && h == b.height[i])) {
+      u32 p = b.parent[i];
+      flags &= ~RenderBoxes::MEASURED;
+      b.flags[p] = (b.flags[p] | RenderBoxes::DIRTY) & ~RenderBoxes::MEASURED;
+      dirty.push_back(p);
+    }
+    // the children of splits take their size from it
+    Atom kind = cv.nodes[node_of[i]].kind;
+    if (style->inherited != old_style->inherited || kind == ATOM_HSPLIT ||
+        kind == ATOM_VSPLIT) {
+      u32 first = b.first_child[i], n = b.child_count[i];
+      for (u32 c = first; c < first + n; c++)
+        children.push(c);
+    }
+  }
+
+  // measures depend on the whole subtree
+  auto mark_parent = [&](u32 j) {
+    // the size of a box sized to its content changes with it
+    bool fit = b.width[j].is_fit() || b.height[j].is_fit();
+    u32 p = b.parent[j];
+    b.flags[p] |= fit ? RenderBoxes::DIRTY : RenderBoxes::CHILD_DIRTY;
+    b.flags[p] &= ~RenderBoxes::MEASURED;
+  };
+  if (dirty.size() > b.size() / 16) {
+    // as in update(), children come after their parent
+    for (u32 i = b.size(); i-- > 1;) {
+      if (b.flags[i] & (RenderBoxes::DIRTY | RenderBoxes::CHILD_DIRTY))
+        mark_parent(i);
+    }
+    return;
+  }
+  for (u32 i : dirty) {
+    for (u32 j = i; j > 0; j = b.parent[j])
+      mark_parent(j);
+  }
+}
+
+// Sizes along the axis of a COLUMN (heights) or ROW (widths), in `sizes`:
+// the children with a size set get it, the others share the room left.
+// Returns false if there is none left for them.
+bool distribute(Length const *size, u32 n, f32 parent, f32 gap, f32 room,
+                std::vector<f32> &sizes) {
+  sizes.resize(n);
+  f32 *out = sizes.data();
+  u32 unset = 0;
+  for (u32 k = 0; k < n; k++) {
+    out[k] = size[k].get(parent);
+    unset += !size[k].is_set();
+  }
+  // in order, to get the same rounding whatever the vectorization
+  room -= gap * std::max(0.f, f32(n) - 1.f);
+  for (u32 k = 0; k < n; k++) {
+    if (size[k].is_set())
+      room -= out[k];
+  }
+  if (unset == 0)
+    return true;
+  if (room <= 0.f)
+    return false;
+  f32 share = room / f32(unset);
+  for (u32 k = 0; k < n; k++)
+    out[k] = size[k].is_set() ? out[k] : share;
+  return true;
+}
+
+// margins and padding across, of a box `w` wide or `h` high
+f32 inset_x(ResolvedStyle const &style, f32 w) {
+  return style.margin.l.get(w) + style.padding.l.get(w) +
+         style.margin.r.get(w) + style.padding.r.get(w);
+}
+
+f32 inset_y(ResolvedStyle const &style, f32 h) {
+  return style.margin.t.get(h) + style.padding.t.get(h) +
+         style.margin.b.get(h) + style.padding.b.get(h);
+}
+
+void RenderTree::child_sizes(u32 i, Size basis, Size room, u32 worker) {
+  auto &b = boxes;
+  auto &sizes = scratch[worker].sizes;
+  auto &lengths = scratch[worker].lengths;
+  u32 first = b.first_child[i], n = b.child_count[i];
+  auto mode = b.mode[i];
+  // what the sizes set are relative to, columns and rows stretch their
+  // children across
+  f32 pw = mode == RenderBoxes::ROW ? basis.w : room.w;
+  f32 ph = mode == RenderBoxes::COLUMN ? basis.h : room.h;
+  bool set_w = mode != RenderBoxes::COLUMN;
+  bool set_h = mode != RenderBoxes::ROW;
+
+  // before anything else, measuring recurses. Nothing is offered on the
+  // axes sized to the content.
+  for (u32 c = first; c < first + n; c++) {
+    Length cw = b.width[c], ch = b.height[c];
+    if (!cw.is_fit() && !ch.is_fit())
+      continue;
+    Size o = {cw.is_fit() ? 0.f : set_w && cw.is_set() ? cw.get(pw) : room.w,
+              ch.is_fit() ? 0.f : set_h && ch.is_set() ? ch.get(ph) : room.h};
+    b.child_offer[c] = o;
+    b.child_size[c] = measure(c, o, worker);
+  }
+
+  // sizes along columns and rows, with the measured ones set
+  bool room_left = true;
+  if (mode == RenderBoxes::COLUMN || mode == RenderBoxes::ROW) {
+    bool row = mode == RenderBoxes::ROW;
+    auto const &size = row ? b.width : b.height;
+    lengths.resize(n);
+    for (u32 k = 0; k < n; k++) {
+      u32 c = first + k;
+      Size m = b.child_size[c];
+      lengths[k] = size[c].is_fit() ? Length(row ? m.w : m.h, 0.f) : size[c];
+    }
+    f32 gap = b.style[i]->gap.get(row ? basis.w : basis.h);
+    room_left = distribute(lengths.data(), n, row ? pw : ph, gap,
+                           row ? room.w : room.h, sizes);
+  }
+  auto own = [](Length l, bool set, f32 measured, f32 parent, f32 room) {
+    if (l.is_fit())
+      return measured;
+    return set && l.is_set() ? l.get(parent) : room;
+  };
+  for (u32 k = 0; k < n; k++) {
+    u32 c = first + k;
+    Length cw = b.width[c], ch = b.height[c];
+    Size m = b.child_size[c];
+    Size s = {own(cw, set_w, m.w, pw, room.w), own(ch, set_h, m.h, ph, room.h)};
+    u8 no_room = 0;
+    if (mode == RenderBoxes::COLUMN) {
+      s.h = sizes[k];
+      no_room = !room_left && !lengths[k].is_set();
+    } else if (mode == RenderBoxes::ROW) {
+      s.w = sizes[k];
+      no_room = !room_left && !lengths[k].is_set();
+    }
+    b.child_size[c] = s;
+    // the ones sized to their content were offered the room
+    b.child_offer[c] = {cw.is_fit() ? b.child_offer[c].w : s.w,
+                        ch.is_fit() ? b.child_offer[c].h : s.h};
+    b.flags[c] = (b.flags[c] & ~RenderBoxes::NO_ROOM) |
+                 (no_room ? RenderBoxes::NO_ROOM : 0);
+  }
+}
+
+Size RenderTree::measure(u32 i, Size o, u32 worker) {
+  auto &b = boxes;
+  if ((b.flags[i] & RenderBoxes::MEASURED) && b.measure_key[i] == o)
+    return b.measured[i];
+  // on the axes sized to the content, children get no room and no
+  // percentage of anything, so the ones with no size set add nothing
+  auto const &style = *b.style[i];
+  bool fit_w = b.width[i].is_fit(), fit_h = b.height[i].is_fit();
+  f32 ix = inset_x(style, o.w), iy = inset_y(style, o.h);
+  Size room = {fit_w ? 0.f : o.w - ix, fit_h ? 0.f : o.h - iy};
+  child_sizes(i, o, room, worker);
+
+  // extent of the children, as layout will place them, with the sizes set
+  // of the stretched ones
+  u32 first = b.first_child[i], n = b.child_count[i];
+  auto mode = b.mode[i];
+  f32 pw = mode == RenderBoxes::ROW ? o.w : room.w;
+  f32 ph = mode == RenderBoxes::COLUMN ? o.h : room.h;
+  auto own = [](Length l, f32 parent) {
+    return l.is_set() && !l.is_fit() ? l.get(parent) : 0.f;
+  };
+  Size content = {0.f, 0.f};
+  for (u32 c = first; c < first + n; c++) {
+    Size s = b.child_size[c];
+    if (b.flags[c] & RenderBoxes::NO_ROOM)
+      s = {0.f, 0.f};
+    if (mode == RenderBoxes::ROW)
+      content.w += s.w;
+    else
+      content.w = std::max({content.w, s.w, own(b.width[c], pw)});
+    if (mode == RenderBoxes::COLUMN)
+      content.h += s.h;
+    else
+      content.h = std::max({content.h, s.h, own(b.height[c], ph)});
+  }
+  if (n > 1 && mode == RenderBoxes::COLUMN)
+    content.h += style.gap.get(o.h) * f32(n - 1);
+  if (n > 1 && mode == RenderBoxes::ROW)
+    content.w += style.gap.get(o.w) * f32(n - 1);
+
+  Size size = {fit_w ? content.w + ix : o.w, fit_h ? content.h + iy : o.h};
+  b.measure_key[i] = o;
+  b.measured[i] = size;
+  b.flags[i] |= RenderBoxes::MEASURED;
+  return size;
+}
+
+Rect RenderTree::area(u32 i) const {
+  auto const &b = boxes;
+  auto [x, y, w, h] = b.rect[i];
+  auto [bw, bh] = b.offered[i];
+  auto const &margin = b.style[i]->margin;
+  return {x + margin.l.get(bw), y + margin.t.get(bh),
+          w - margin.l.get(bw) - margin.r.get(bw),
+          h - margin.t.get(bh) - margin.b.get(bh)};
+}
+
+void RenderTree::update_bounds() {
+  auto &b = boxes;
+  auto compute = [&](u32 i) {
+    u8 &flags = b.flags[i];
+    Bounds r;
+    if (!(flags & RenderBoxes::HIDDEN)) {
+      // only the ones that did not move read their style again
+      r = flags & RenderBoxes::OWN_BOUNDS ? b.bounds[i] : Bounds(area(i));
+      u32 first = b.first_child[i], n = b.child_count[i];
+      for (u32 c = first; c < first + n; c++)
+        r.merge(b.flags[c] & RenderBoxes::HIDDEN ? Bounds() : b.bounds[c]);
+    }
+    b.bounds[i] = r;
+    flags &= ~(RenderBoxes::OWN_BOUNDS | RenderBoxes::BOUNDS);
+  };
+
+  u64 n_moved = 0;
+  for (auto &s : scratch)
+    n_moved += s.moved.size();
+  if (n_moved > b.size() / 8) {
+    // most of the tree moved, children come after their parent
+    for (auto &s : scratch)
+      s.moved.clear();
+    for (u32 i = b.size(); i-- > 0;) {
+      if (!(b.flags[i] & (RenderBoxes::OWN_BOUNDS | RenderBoxes::BOUNDS)))
+        continue;
+      compute(i);
+      if (i > 0)
+        b.flags[b.parent[i]] |= RenderBoxes::BOUNDS;
+    }
+    return;
+  }
+
+  // the stacks are empty between layouts
+  auto &pending = scratch[0].stack;
+  for (auto &s : scratch) {
+    for (u32 i : s.moved) {
+      pending.push_back(i);
+      // up to the first one already pending
+      for (u32 j = b.parent[i];
+           j != NO_NODE && !(b.flags[j] & RenderBoxes::BOUNDS);
+           j = b.parent[j]) {
+        b.flags[j] |= RenderBoxes::BOUNDS;
+        pending.push_back(j);
       }
     }
-  } else if (children_mode == ROW) {
-    f32 rem_w = new_w;
-    u32 rem_w_cnt = 0;
-    auto gap_val = gap.get_f32(w);
-    rem_w -= gap_val * std::max(0.f, f32(children.size()) - 1.f);
-    for (auto const &c : children) {
-      if (c.width.val != INFINITY) {
-        rem_w -= c.width.get_f32(w);
+    s.moved.clear();
+  }
+  std::sort(pending.begin(), pending.end(), std::greater<u32>());
+  pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+  for (u32 i : pending)
+    compute(i);
+  pending.clear();
+}
+
+u32 RenderTree::box_at(f32 x, f32 y) const {
+  auto const &b = boxes;
+  // the last painted first: the children of a box from the last one, then
+  // the box itself
+  std::vector<std::pair<u32, bool>> stack;
+  if (b.size() > 0)
+    stack.push_back({0, false});
+  while (!stack.empty()) {
+    auto [i, children_done] = stack.back();
+    stack.pop_back();
+    if (children_done) {
+      if (Bounds(area(i)).contains(x, y))
+        return i;
+      continue;
+    }
+    if ((b.flags[i] & RenderBoxes::HIDDEN) || !b.bounds[i].contains(x, y))
+      continue;
+    stack.push_back({i, true});
+    u32 first = b.first_child[i], n = b.child_count[i];
+    for (u32 c = first; c < first + n; c++)
+      stack.push_back({c, false});
+  }
+  return NO_NODE;
+}
+
+void RenderTree::boxes_in(Rect rect, std::vector<u32> &out) const {
+  auto const &b = boxes;
+  Bounds r = rect;
+  std::vector<u32> stack;
+  if (b.size() > 0)
+    stack.push_back(0);
+  while (!stack.empty()) {
+    u32 i = stack.back();
+    stack.pop_back();
+    if ((b.flags[i] & RenderBoxes::HIDDEN) || !r.overlaps(b.bounds[i]))
+      continue;
+    if (r.overlaps(area(i)))
+      out.push_back(i);
+    // in reverse, so that they come out in order
+    u32 first = b.first_child[i], n = b.child_count[i];
+    for (u32 c = first + n; c-- > first;)
+      stack.push_back(c);
+  }
+}
+
+bool RenderTree::use_pool() {
+  if (!pool || boxes.size() < 2 * PARALLEL_MIN_BOXES)
+    return false;
+  if (scratch.size() < pool->size())
+    scratch.resize(pool->size());
+  return true;
+}
+
+RenderTree::Job &RenderTree::new_job(u32 worker, u32 first, u32 n) {
+  auto &s = scratch[worker];
+  if (s.jobs_used == s.jobs.size())
+    s.jobs.emplace_back();
+  Job &job = s.jobs[s.jobs_used++];
+  job.tree = this;
+  job.first = first;
+  job.n = n;
+  job.cmds.clear();
+  job.splices.clear();
+  return job;
+}
+
+template <typename F> u32 RenderTree::split_children(u32 i, F &&spawn) {
+  u32 first = boxes.first_child[i], end = first + boxes.child_count[i];
+  if (!pool || boxes.subtree_size[i] - 1 < 2 * PARALLEL_MIN_BOXES)
+    return first;
+  u32 size = 0;
+  for (u32 c = first; c + 1 < end; c++) {
+    size += boxes.subtree_size[c];
+    if (size >= PARALLEL_MIN_BOXES) {
+      spawn(first, c + 1 - first);
+      first = c + 1;
+      size = 0;
+    }
+  }
+  return first;
+}
+
+void RenderTree::layout(Rect r) {
+  auto &b = boxes;
+  if (b.size() == 0)
+    return;
+  bool parallel = use_pool();
+  if (!(r == b.rect[0]) || (b.flags[0] & RenderBoxes::HIDDEN)) {
+    b.rect[0] = r;
+    b.offered[0] = {r.w, r.h};
+    b.flags[0] = (b.flags[0] & ~RenderBoxes::HIDDEN) | RenderBoxes::DIRTY;
+  }
+  if (!parallel) {
+    layout_range(0, 1, 0);
+    update_bounds();
+    return;
+  }
+  for (auto &s : scratch)
+    s.jobs_used = 0;
+  Job &root = new_job(0, 0, 1);
+  auto run = [](void *data, u32, u32 worker) {
+    auto &job = *static_cast<Job *>(data);
+    job.tree->layout_range(job.first, job.n, worker);
+  };
+  pool->run({run, &root, 0});
+  update_bounds();
+}
+
+void RenderTree::layout_range(u32 first, u32 n, u32 worker) {
+  auto &b = boxes;
+  auto &stack = scratch[worker].stack;
+  auto &moved = scratch[worker].moved;
+  // the boxes of [first, first + n) that have to be visited
+  auto visit = [&](u32 first, u32 n) {
+    for (u32 c = first; c < first + n; c++) {
+      // hidden ones are placed when they get room again
+      u8 f = b.flags[c];
+      if (!(f & RenderBoxes::HIDDEN) &&
+          (f & (RenderBoxes::DIRTY | RenderBoxes::CHILD_DIRTY)))
+        stack.push_back(c);
+    }
+  };
+  auto spawn = [&](u32 first, u32 n) {
+    auto run = [](void *data, u32, u32 worker) {
+      auto &job = *static_cast<Job *>(data);
+      job.tree->layout_range(job.first, job.n, worker);
+    };
+    pool->spawn(worker, {run, &new_job(worker, first, n), 0});
+  };
+
+  // the parent gives box `i` rect `r`, offering it `o`
+  auto place = [&](u32 i, Rect r, Size o) {
+    u8 &flags = b.flags[i];
+    if (r == b.rect[i] && o == b.offered[i] &&
+        !(flags & (RenderBoxes::DIRTY | RenderBoxes::HIDDEN)))
+      return;
+    b.rect[i] = r;
+    b.offered[i] = o;
+    flags = (flags & ~RenderBoxes::HIDDEN) | RenderBoxes::DIRTY;
+  };
+  auto hide = [&](u32 i) {
+    b.flags[i] |= RenderBoxes::HIDDEN | RenderBoxes::OWN_BOUNDS;
+    moved.push_back(i);
+  };
+
+  visit(first, n);
+  while (!stack.empty()) {
+    u32 i = stack.back();
+    stack.pop_back();
+    u32 first = b.first_child[i], n = b.child_count[i];
+    u8 &flags = b.flags[i];
+    if (!(flags & RenderBoxes::DIRTY)) {
+      flags &= ~RenderBoxes::CHILD_DIRTY;
+      u32 rest = split_children(i, spawn);
+      visit(rest, first + n - rest);
+      continue;
+    }
+    flags &= ~(RenderBoxes::DIRTY | RenderBoxes::CHILD_DIRTY);
+    flags |= RenderBoxes::OWN_BOUNDS;
+    moved.push_back(i);
+    b.bounds[i] = area(i);
+    auto [bw, bh] = b.offered[i];
+    auto const &style = *b.style[i];
+    f32 new_x = b.rect[i].x + style.margin.l.get(bw) + style.padding.l.get(bw);
+    f32 new_y = b.rect[i].y + style.margin.t.get(bh) + style.padding.t.get(bh);
+    // a box sized to its content stretches its children to it, but gives
+    // none of them more room along its column or row than in measure()
+    auto mode = b.mode[i];
+    Size room = {b.rect[i].w - inset_x(style, bw),
+                 b.rect[i].h - inset_y(style, bh)};
+    if (mode == RenderBoxes::ROW && b.width[i].is_fit())
+      room.w = 0.f;
+    if (mode == RenderBoxes::COLUMN && b.height[i].is_fit())
+      room.h = 0.f;
+    child_sizes(i, {bw, bh}, room, worker);
+    f32 gap = style.gap.get(mode == RenderBoxes::ROW ? bw : bh);
+    for (u32 c = first; c < first + n; c++) {
+      Size size = b.child_size[c];
+      if (b.flags[c] & RenderBoxes::NO_ROOM) {
+        hide(c);
+        size = {0.f, 0.f};
       } else {
-        rem_w_cnt++;
+        place(c, {new_x, new_y, size.w, size.h}, b.child_offer[c]);
       }
+      if (mode == RenderBoxes::COLUMN)
+        new_y += size.h + gap;
+      else if (mode == RenderBoxes::ROW)
+        new_x += size.w + gap;
     }
-    if (rem_w_cnt == 0) {
-      for (auto const &c : children) {
-        f32 c_w = c.width.get_f32(w);
-        c.render(new_x, new_y, c_w, new_h, list);
-        new_x += c_w + gap_val;
-      }
-    } else if (rem_w <= 0.f) {
-      for (auto const &c : children) {
-        f32 c_w = 0;
-        if (c.width.val != INFINITY) {
-          c_w = c.width.get_f32(w);
-          c.render(new_x, new_y, c_w, new_h, list);
-        }
-        new_x += c_w + gap_val;
-      }
-    } else {
-      rem_w = rem_w / f32(rem_w_cnt);
-      for (auto const &c : children) {
-        f32 c_w = rem_w;
-        if (c.width.val != INFINITY) {
-          c_w = c.width.get_f32(w);
-        }
-        c.render(new_x, new_y, c_w, new_h, list);
-        new_x += c_w + gap_val;
-      }
+    u32 rest = split_children(i, spawn);
+    visit(rest, first + n - rest);
+  }
+}
+
+void RenderTree::emit(RenderList &list) {
+  culling = false;
+  emit_tree(list);
+}
+
+void RenderTree::emit(RenderList &list, Rect clip) {
+  this->clip = clip;
+  culling = true;
+  emit_tree(list);
+}
+
+void RenderTree::emit_tree(RenderList &list) {
+  if (boxes.size() == 0)
+    return;
+  if (!use_pool()) {
+    std::vector<std::pair<u32, Job const *>> none;
+    emit_range(0, 1, list, none, 0);
+    return;
+  }
+  for (auto &s : scratch)
+    s.jobs_used = 0;
+  Job &root = new_job(0, 0, 1);
+  auto run = [](void *data, u32, u32 worker) {
+    auto &job = *static_cast<Job *>(data);
+    job.tree->emit_range(job.first, job.n, job.cmds, job.splices, worker);
+  };
+  pool->run({run, &root, 0});
+
+  // put the jobs together, each one's splices in its commands
+  struct Frame {
+    Job const *job;
+    u32 splice, pos;
+  };
+  std::vector<Frame> frames = {{&root, 0, 0}};
+  while (!frames.empty()) {
+    auto &f = frames.back();
+    auto const &cmds = f.job->cmds;
+    if (f.splice == f.job->splices.size()) {
+      list.insert(list.end(), cmds.begin() + f.pos, cmds.end());
+      frames.pop_back();
+      continue;
     }
+    auto [at, job] = f.job->splices[f.splice++];
+    list.insert(list.end(), cmds.begin() + f.pos, cmds.begin() + at);
+    f.pos = at;
+    frames.push_back({job, 0, 0});
   }
 }
 
-void RenderBox::needed_size(f32 &w, f32 &h) const {
-  w = width.val;
-  h = height.val;
+void RenderTree::emit_range(u32 first, u32 n, RenderList &out,
+                            std::vector<std::pair<u32, Job const *>> &splices,
+                            u32 worker) {
+  auto const &b = boxes;
+  auto &stack = scratch[worker].stack;
+  auto spawn = [&](u32 first, u32 n) {
+    auto run = [](void *data, u32, u32 worker) {
+      auto &job = *static_cast<Job *>(data);
+      job.tree->emit_range(job.first, job.n, job.cmds, job.splices, worker);
+    };
+    Job &job = new_job(worker, first, n);
+    splices.push_back({u32(out.size()), &job});
+    pool->spawn(worker, {run, &job, 0});
+  };
+  // in reverse, so that they come out in order
+  auto visit = [&](u32 first, u32 n) {
+    for (u32 c = first + n; c-- > first;)
+      stack.push_back(c);
+  };
+
+  visit(first, n);
+  while (!stack.empty()) {
+    u32 i = stack.back();
+    stack.pop_back();
+    if (b.flags[i] & RenderBoxes::HIDDEN)
+      continue;
+    if (culling && !clip.overlaps(b.bounds[i]))
+      continue;
+    auto const &style = *b.style[i];
+    Rect a = area(i);
+    if (style.background_color.a != 0 &&
+        (!culling || clip.overlaps(a))) {
+      // render a rectangle:
+      RenderCmd cmd;
+      cmd.x = a.x;
+      cmd.w = a.w;
+      cmd.y = a.y;
+      cmd.h = a.h;
+      cmd.r = style.corner_radius.get(std::min(b.rect[i].w, b.rect[i].h) / 2.f);
+      cmd.c = style.background_color;
+      cmd.id = b.path[i];
+      out.push_back(cmd);
+    }
+    u32 rest = split_children(i, spawn);
+    visit(rest, b.first_child[i] + b.child_count[i] - rest);
+  }
 }
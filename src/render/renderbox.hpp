@@ -4,45 +4,292 @@
 #include "../file/filedata.hpp"
 #include "color.hpp"
 #include "renderlist.hpp"
+#include "taskpool.hpp"
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
 #include <vector>
 
-struct LayoutElem;
 struct CV;
 
 struct TextStyle {
   // TODO:
 };
 
+// A length with its units resolved, as `abs + pc * parent` where `parent` is
+// the size it is relative to. Unset sizes have an infinite `abs`, sizes that
+// fit the content (Value::FIT) a negative infinite one.
+struct Length {
+  f32 abs = 0.f, pc = 0.f;
+  Length() = default;
+  constexpr Length(f32 abs, f32 pc) : abs(abs), pc(pc) {}
+  // of a value in NO_UNIT, PC or FIT
+  Length(Value v);
+  f32 get(f32 parent) const { return abs + pc * parent; }
+  bool is_set() const { return abs != INFINITY; }
+  bool is_fit() const { return abs == -INFINITY; }
+  bool operator==(Length const &) const = default;
+};
+
 struct Inset {
-  Value l = 0.f, r = 0.f, t = 0.f, b = 0.f;
+  Length l, r, t, b;
+  bool operator==(Inset const &) const = default;
+};
+
+struct Rect {
+  f32 x = 0.f, y = 0.f, w = -1.f, h = -1.f;
+  bool operator==(Rect const &) const = default;
+};
+
+// Bounding box, by its edges, which are included. The default one is empty
+// so merging is only taking the min and max.
+struct Bounds {
+  f32 x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+  Bounds() = default;
+  // of a rect of any sign, which is drawn flipped when negative
+  Bounds(Rect r)
+      : x0(std::min(r.x, r.x + r.w)), y0(std::min(r.y, r.y + r.h)),
+        x1(std::max(r.x, r.x + r.w)), y1(std::max(r.y, r.y + r.h)) {}
+  bool operator==(Bounds const &) const = default;
+  void merge(Bounds const &o) {
+    x0 = std::min(x0, o.x0);
+    y0 = std::min(y0, o.y0);
+    x1 = std::max(x1, o.x1);
+    y1 = std::max(y1, o.y1);
+  }
+  bool contains(f32 x, f32 y) const {
+    return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+  }
+  bool overlaps(Bounds const &o) const {
+    return x0 <= o.x1 && o.x0 <= x1 && y0 <= o.y1 && o.y0 <= y1;
+  }
+};
+
+struct Size {
+  f32 w = -1.f, h = -1.f;
+  bool operator==(Size const &) const = default;
+};
+
+// Resolved values of the properties that do not depend on where the
+// element is in the tree. They are shared by all the elements with the
+// same style and overrides, see StyleCache.
+struct ResolvedStyle {
+  Length gap;
+  Inset margin;
+  Inset padding;
+  Color background_color;
+  Length corner_radius;
+  // resolved from values in vw or vh
+  bool viewport = false;
+  // what the element's children inherit (see INHERITED_PROPS), null if
+  // nothing
+  PropBlock const *inherited = nullptr;
 };
 
-struct ContentElem;
+// Interns ResolvedStyles by the element's own properties (its style
+// included), what it inherits and the viewport, so each distinct
+// combination is resolved once. Records keep their address until reset().
+//
+// Properties cascade from the document styles, to the element's style, to
+// the element's own properties, each overriding the previous ones. The
+// inherited properties are snapshots, interned too, so a child that does not
+// change them shares its parent's and comparing them is comparing pointers.
+struct StyleCache {
+  struct Key {
+    PropBlock const *inherited;
+    u32 present;
+    f32 vw, vh;
+    Value values[PROP_COUNT]; // of the set slots, in order, the rest zero
+    bool operator==(Key const &o) const;
+  };
+  struct KeyHash {
+    u64 operator()(Key const &k) const;
+  };
+  std::deque<ResolvedStyle> records;
+  // of before the last reset(), RenderTree::update compares with them
+  std::deque<ResolvedStyle> previous;
+  std::unordered_map<Key, ResolvedStyle const *, KeyHash> index;
+  std::deque<PropBlock> snapshots;
+  std::unordered_map<Key, PropBlock const *, KeyHash> snapshot_index;
+  // the document styles of the CV, merged in order
+  PropBlock document;
+
+  ResolvedStyle const *get(PropSlice const &elt_props,
+                           PropBlock const *inherited, CV const &cv);
+  PropBlock const *snapshot(PropBlock const &props);
+  // the values of the styles set in `changed`, indexed by style, changed,
+  // the elements with them resolve again
+  void forget(std::vector<bool> const &changed);
+  // forget everything and take the document styles of `cv`
+  void reset(CV const &cv);
+};
 
-struct RenderBox {
-  enum ChildrenMode {
+// The boxes of a layout, as flat arrays indexed by box. Boxes are numbered
+// breadth-first, so the children of a box are contiguous, from
+// `first_child` on, which lets layout place them with plain loops over the
+// arrays. Only measuring walks it recursively.
+struct RenderBoxes {
+  enum ChildrenMode : u8 {
     UNIQUE, // element put in top-left of container
     COLUMN, // elements disposed in a dynamically calculated column
     ROW,    // elements disposed in a dynamically calculated row
     LAYER,  // same as unique but can have multiple children
-  } children_mode = UNIQUE;
-  std::vector<RenderBox> children = {};
-  std::vector<TextStyle> text_styles = {};
-  Value width = -1.0f;
-  Value height = -1.0f;
-  Value gap = 0.0f;
-  Inset margin = {};
-  Inset padding = {};
-  Color background_color;
-  ContentElem *content = nullptr;
-  Value corner_radius = 0.0f;
+  };
+  enum Flags : u8 {
+    DIRTY = 1 << 0,       // its children must be placed again
+    CHILD_DIRTY = 1 << 1, // one of its descendants is dirty
+    HIDDEN = 1 << 2,      // got no room in the last layout
+    MEASURED = 1 << 3,    // `measured` holds measure(measure_key)
+    NO_ROOM = 1 << 4,     // see `child_size`
+    OWN_BOUNDS = 1 << 5,  // `bounds` only holds the box's area yet
+    BOUNDS = 1 << 6,      // the bounds of a descendant changed
+    VIEWPORT = 1 << 7,    // its style or size has values in vw or vh
+  };
+  std::vector<u32> parent;
+  std::vector<u32> first_child;
+  std::vector<u32> child_count;
+  std::vector<u8> mode;
+  std::vector<u8> flags;
+  // set by the parent for splits, so not part of the style
+  std::vector<Length> width;
+  std::vector<Length> height;
+  std::vector<ResolvedStyle const *> style;
+  // given by the parent in the last layout, margins included
+  std::vector<Rect> rect;
+  // What the parent offered in the last layout: the size of the rect, but
+  // the room that was available on the axes sized to the content. The
+  // percentages of the box resolve against it.
+  std::vector<Size> offered;
+  // boxes in the subtree, itself included
+  std::vector<u32> subtree_size;
+  // hash of the positions of the box and its ancestors among their
+  // siblings, which identifies its commands across updates
+  std::vector<u32> path;
+  // What the visible boxes of the subtree cover, empty if nothing. With it
+  // the tree is a bounding volume hierarchy, which culling and hit testing
+  // walk down only where it overlaps what they look for.
+  std::vector<Bounds> bounds;
+
+  // memo of RenderTree::measure
+  std::vector<Size> measure_key;
+  std::vector<Size> measured;
+  // size and offer computed by the parent for its children, and NO_ROOM if
+  // there was no room left for the child (see RenderTree::child_sizes)
+  std::vector<Size> child_size;
+  std::vector<Size> child_offer;
+
+  u32 size() const { return parent.size(); }
+  void clear();
+  void reserve(u32 n);
+};
+
+// Once a box placed its children their subtrees are independent, so
+// children ranges of large boxes are laid out and emitted by the tasks of a
+// TaskPool. Emitting tasks write to their own Job, which are put together in
+// document order.
+struct RenderTree {
+  struct Job {
+    RenderTree *tree;
+    u32 first, n; // range of boxes
+    RenderList cmds;
+    // (position in cmds, job) of the ranges emitted by other tasks
+    std::vector<std::pair<u32, Job const *>> splices;
+  };
+  // per worker
+  struct Scratch {
+    std::vector<u32> stack;
+    std::vector<f32> sizes;
+    std::vector<Length> lengths;
+    // boxes whose area changed in the layout, or that were hidden, with
+    // OWN_BOUNDS
+    std::vector<u32> moved;
+    std::deque<Job> jobs;
+    u32 jobs_used = 0;
+  };
+
+  RenderBoxes boxes;
+  // of before the last update(), and scratch space
+  RenderBoxes old;
+  std::vector<u32> node_of;
+  // box of each node of the CV, NO_NODE if not in the tree
+  std::vector<u32> box_of;
+  // index in CV::style of the style of each box, -1 if none
+  std::vector<i32> style_of;
+  // the ones with VIEWPORT, and some that lost it since the last resize()
+  std::vector<u32> viewport_boxes;
+  std::vector<u32> match;
+
+  // Lays out and emits trees of over PARALLEL_MIN_BOXES boxes, null for the
+  // calling thread alone. Ranges of children are split in tasks of about
+  // that many boxes. Not owned, trees that are not laid out at the same
+  // time share one.
+  TaskPool *pool = nullptr;
+  static constexpr u32 PARALLEL_MIN_BOXES = 4096;
+  std::vector<Scratch> scratch = std::vector<Scratch>(1);
+  // of the emit() running, if it culls
+  Bounds clip;
+  bool culling = false;
 
-  RenderBox() = default;
-  RenderBox(LayoutElem const &, CV const &);
+  // Takes the properties of the layout rooted at `root` again, after the
+  // document or the viewport changed, and marks dirty what has to be placed
+  // again. Boxes are matched with the previous ones by position.
+  void update(CV const &, u32 root, StyleCache &styles);
+  // Takes the properties of the boxes that `changes` touched again, and of
+  // the children they pass other inherited properties to, marking dirty
+  // what has to be placed again. Returns false if the whole tree has to be
+  // updated instead, when a document style changed.
+  bool restyle(CV const &, CVChanges const &changes, StyleCache &styles);
+  // takes the values in vw and vh again, after the viewport size of the CV
+  // changed
+  void resize(CV const &, StyleCache &styles);
+  // places the children of the dirty boxes and of the ones given a new rect
+  void layout(Rect r);
+  // pushes the commands of the whole tree, from the rects of the last layout
+  void emit(RenderList &list);
+  // only the ones overlapping `clip`, in the same order
+  void emit(RenderList &list, Rect clip);
 
-  void needed_size(f32 &w, f32 &h) const;
+  // what box `i` covers: its rect inside the margins
+  Rect area(u32 i) const;
+  // the topmost box at (x, y), NO_NODE if none
+  u32 box_at(f32 x, f32 y) const;
+  // the boxes overlapping `r`, in document order
+  void boxes_in(Rect r, std::vector<u32> &out) const;
 
-  void render(f32 x, f32 y, f32 w, f32 h, RenderList &list) const;
+  // the style and the sizes of box `i` from the properties of its element,
+  // once its parent has its own, its style given if already known. Returns
+  // true if they depend on the viewport.
+  bool resolve(CV const &, u32 i, StyleCache &styles,
+               ResolvedStyle const *style = nullptr);
+  // Resolves the boxes of `pending` again, and what they pass inherited
+  // properties to, and marks dirty what has to be placed again. With
+  // `resized`, only the viewport changed, so boxes that had the same style
+  // get the same one again.
+  void restyle_boxes(CV const &, std::vector<u32> &pending, StyleCache &styles,
+                     bool resized);
+  // whether the pool takes this tree, with scratch for each of its workers
+  bool use_pool();
+  Job &new_job(u32 worker, u32 first, u32 n);
+  // calls `spawn(first, n)` for the ranges of children of `i` given to other
+  // tasks, returns the first child of the range left
+  template <typename F> u32 split_children(u32 i, F &&spawn);
+  void layout_range(u32 first, u32 n, u32 worker);
+  // merges the children in the bounds of the moved boxes and of their
+  // ancestors, children first
+  void update_bounds();
+  // Sizes of the children of `i`, given percentages of `basis` and `room`
+  // left inside its margins and padding, in `child_size` and `child_offer`.
+  // The content-sized ones are measured first.
+  void child_sizes(u32 i, Size basis, Size room, u32 worker);
+  // Size of box `i` offered `o`, the one of its content on the axes sized to
+  // it. Memoized per box until something in its subtree changes, so every
+  // box is measured once per offer whatever the nesting. Recurses as deep as
+  // content-sized boxes are nested.
+  Size measure(u32 i, Size o, u32 worker);
+  void emit_tree(RenderList &list);
+  void emit_range(u32 first, u32 n, RenderList &out,
+                  std::vector<std::pair<u32, Job const *>> &splices,
+                  u32 worker);
 };
 
 #endif // !RENDERBOX_HPP
@@ -1,2 +1,47 @@
 #include "renderlist.hpp"
 #include <iostream>
+#include <unordered_map>
+
+void diff_lists(RenderList const &old, RenderList const &cur, ListDiff &out) {
+  // the vector keeps its room from one diff to the next
+  out.reused = out.updated = out.added = out.removed = 0;
+  out.changed.clear();
+  out.old_index.clear();
+  out.same_order = old.size() == cur.size();
+  for (u32 k = 0; out.same_order && k < cur.size(); k++) {
+    if (old[k].id != cur[k].id) {
+      out.same_order = false;
+    } else if (old[k] == cur[k]) {
+      out.reused++;
+    } else {
+      out.updated++;
+      out.changed.push_back(k);
+    }
+  }
+  if (out.same_order)
+    return;
+
+  // matched by id, see RenderBatch::patch()
+  out.reused = out.updated = 0;
+  out.changed.clear();
+  out.old_index.reserve(cur.size());
+  std::unordered_map<u32, u32> old_of;
+  old_of.reserve(old.size());
+  for (u32 k = 0; k < old.size(); k++)
+    old_of.emplace(old[k].id, k);
+  for (auto const &c : cur) {
+    auto it = old_of.find(c.id);
+    if (it == old_of.end()) {
+      out.added++;
+      out.old_index.push_back(ListDiff::NONE);
+      continue;
+    }
+    out.old_index.push_back(it->second);
+    if (old[it->second] == c)
+      out.reused++;
+    else
+      out.updated++;
+    old_of.erase(it);
+  }
+  out.removed = old_of.size();
+}
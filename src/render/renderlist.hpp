@@ -8,8 +8,27 @@ struct RenderCmd {
   // only boxes for now
   f32 x, y, w, h, r;
   Color c;
+  // of the box drawn, the same from one layout to the next for the box at
+  // the same place in the tree (see RenderBoxes::path)
+  u32 id;
+  bool operator==(RenderCmd const &) const = default;
 };
 
 using RenderList = std::vector<RenderCmd>;
 
+// What changed from one list to the next, commands being matched by id
+struct ListDiff {
+  u32 reused = 0, updated = 0, added = 0, removed = 0;
+  // the same commands in the same order, only some changed
+  bool same_order = true;
+  // the updated commands of the new list, when in the same order
+  std::vector<u32> changed;
+  // when not, the command of the old list with the id of each command of
+  // the new one, or NONE
+  static constexpr u32 NONE = ~0u;
+  std::vector<u32> old_index;
+};
+
+void diff_lists(RenderList const &old, RenderList const &cur, ListDiff &out);
+
 #endif // !RENDERLIST_HPP
@@ -0,0 +1,78 @@
+#include "taskpool.hpp"
+
+TaskPool::TaskPool(u32 n_workers) {
+  for (u32 w = 0; w < n_workers; w++)
+    queues.push_back(std::make_unique<Queue>());
+  for (u32 w = 1; w < n_workers; w++) {
+    threads.emplace_back([this, w] {
+      while (true) {
+        if (run_one(w))
+          continue;
+        std::unique_lock guard(lock);
+        wake.wait(guard, [&] { return stop || queued > 0; });
+        if (stop)
+          return;
+      }
+    });
+  }
+}
+
+TaskPool::~TaskPool() {
+  {
+    std::lock_guard guard(lock);
+    stop = true;
+  }
+  wake.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+void TaskPool::spawn(u32 worker, Task t) {
+  pending++;
+  {
+    std::lock_guard guard(queues[worker]->lock);
+    queues[worker]->tasks.push_back(t);
+  }
+  {
+    // under the lock, so that a worker going to sleep sees it
+    std::lock_guard guard(lock);
+    queued++;
+  }
+  wake.notify_one();
+}
+
+bool TaskPool::run_one(u32 worker) {
+  Task t;
+  bool found = false;
+  for (u32 i = 0; i < queues.size() && !found; i++) {
+    u32 victim = (worker + i) % queues.size();
+    auto &q = *queues[victim];
+    std::lock_guard guard(q.lock);
+    if (q.tasks.empty())
+      continue;
+    if (victim == worker) {
+      t = q.tasks.back();
+      q.tasks.pop_back();
+    } else {
+      t = q.tasks.front();
+      q.tasks.pop_front();
+    }
+    found = true;
+  }
+  if (!found)
+    return false;
+  queued--;
+  t.fn(t.data, t.arg, worker);
+  pending--;
+  return true;
+}
+
+void TaskPool::run(Task t) {
+  pending++;
+  t.fn(t.data, t.arg, 0);
+  pending--;
+  while (pending > 0) {
+    if (!run_one(0))
+      std::this_thread::yield();
+  }
+}
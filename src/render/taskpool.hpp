@@ -0,0 +1,49 @@
+#ifndef TASKPOOL_HPP
+#define TASKPOOL_HPP
+
+#include "../defines.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: every worker has its own queue of tasks, takes the
+// newest one from it and steals the oldest ones of the others when it is
+// empty. Worker 0 is the thread calling run(), which works too.
+struct TaskPool {
+  struct Task {
+    void (*fn)(void *data, u32 arg, u32 worker);
+    void *data;
+    u32 arg;
+  };
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  // tasks spawned and not finished yet, and queued ones
+  std::atomic<u32> pending = 0;
+  std::atomic<u32> queued = 0;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool stop = false;
+
+  explicit TaskPool(u32 n_workers);
+  ~TaskPool();
+  TaskPool(TaskPool const &) = delete;
+  TaskPool &operator=(TaskPool const &) = delete;
+
+  u32 size() const { return queues.size(); }
+  // from a task running on `worker`
+  void spawn(u32 worker, Task t);
+  // runs `t` and everything it spawns, returns when all of it is done
+  void run(Task t);
+  bool run_one(u32 worker);
+};
+
+#endif // !TASKPOOL_HPP